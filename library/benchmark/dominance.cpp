@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2025 University of Salerno
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Microbenchmark of the signature dominance test used by the filter kernels:
+// per-label loop over getLabelCount vs. the packed SWAR comparison.
+// Usage: bench_dominance [data_nodes] [query_nodes] [repetitions]
+
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sigmo.hpp>
+#include <string>
+#include <sycl/sycl.hpp>
+#include <vector>
+
+using SignatureDevice = sigmo::signature::Signature<>::SignatureDevice;
+
+class DominanceLoopKernel;
+class DominanceSwarKernel;
+
+template<bool Swar>
+std::chrono::duration<double>
+runDominance(sycl::queue& queue, SignatureDevice* data, SignatureDevice* query, uint32_t* matches, size_t data_nodes, size_t query_nodes) {
+  queue.fill(matches, 0u, data_nodes).wait();
+  const uint16_t max_labels = SignatureDevice::getMaxLabels();
+  auto e = queue.submit([&](sycl::handler& cgh) {
+    using Kernel = std::conditional_t<Swar, DominanceSwarKernel, DominanceLoopKernel>;
+    cgh.parallel_for<Kernel>(sycl::range<1>{data_nodes}, [=](sycl::item<1> item) {
+      auto data_signature = data[item.get_id(0)];
+      uint32_t count = 0;
+      for (size_t q = 0; q < query_nodes; ++q) {
+        auto query_signature = query[q];
+        if constexpr (Swar) {
+          count += data_signature.dominates(query_signature);
+        } else {
+          bool keep = true;
+          for (sigmo::types::label_t l = 0; l < max_labels && keep; l++) {
+            keep = keep && (query_signature.getLabelCount(l) <= data_signature.getLabelCount(l));
+          }
+          count += keep;
+        }
+      }
+      matches[item.get_id(0)] = count;
+    });
+  });
+  e.wait();
+  sigmo::utils::BatchedEvent be;
+  be.add(e);
+  return be.getProfilingInfo();
+}
+
+template<typename Selector>
+void benchmarkDevice(const Selector& selector, size_t data_nodes, size_t query_nodes, size_t repetitions) {
+  sycl::queue queue;
+  try {
+    queue = sycl::queue{selector, sycl::property::queue::enable_profiling{}};
+  } catch (sycl::exception& e) {
+    std::cout << "Device not available, skipping" << std::endl;
+    return;
+  }
+  std::cout << "------------- " << queue.get_device().get_info<sycl::info::device::name>() << " -------------" << std::endl;
+
+  std::mt19937_64 rng(42);
+  std::vector<SignatureDevice> host_data(data_nodes), host_query(query_nodes);
+  for (auto& s : host_data) s.signature = rng();
+  for (auto& s : host_query) s.signature = rng() & rng() & rng();
+
+  auto* data = sycl::malloc_device<SignatureDevice>(data_nodes, queue);
+  auto* query = sycl::malloc_device<SignatureDevice>(query_nodes, queue);
+  auto* matches = sycl::malloc_shared<uint32_t>(data_nodes, queue);
+  queue.copy(host_data.data(), data, data_nodes);
+  queue.copy(host_query.data(), query, query_nodes);
+  queue.wait_and_throw();
+
+  std::chrono::duration<double> loop_time{0}, swar_time{0};
+  size_t loop_matches = 0, swar_matches = 0;
+  for (size_t r = 0; r < repetitions; ++r) {
+    loop_time += runDominance<false>(queue, data, query, matches, data_nodes, query_nodes);
+    if (r == 0) loop_matches = std::accumulate(matches, matches + data_nodes, size_t{0});
+    swar_time += runDominance<true>(queue, data, query, matches, data_nodes, query_nodes);
+    if (r == 0) swar_matches = std::accumulate(matches, matches + data_nodes, size_t{0});
+  }
+
+  double comparisons = static_cast<double>(data_nodes) * query_nodes * repetitions;
+  std::cout << "Loop: " << std::chrono::duration_cast<std::chrono::milliseconds>(loop_time).count() << " ms ("
+            << comparisons / loop_time.count() / 1e9 << " Gcmp/s)" << std::endl;
+  std::cout << "SWAR: " << std::chrono::duration_cast<std::chrono::milliseconds>(swar_time).count() << " ms ("
+            << comparisons / swar_time.count() / 1e9 << " Gcmp/s)" << std::endl;
+  std::cout << "Speedup: " << loop_time.count() / swar_time.count() << "x" << std::endl;
+  if (loop_matches != swar_matches) { std::cout << "[!] Mismatch: " << loop_matches << " vs " << swar_matches << std::endl; }
+
+  sycl::free(data, queue);
+  sycl::free(query, queue);
+  sycl::free(matches, queue);
+}
+
+int main(int argc, char** argv) {
+  size_t data_nodes = argc > 1 ? std::stoul(argv[1]) : 1 << 20;
+  size_t query_nodes = argc > 2 ? std::stoul(argv[2]) : 1024;
+  size_t repetitions = argc > 3 ? std::stoul(argv[3]) : 5;
+
+  std::cout << "# Data Nodes " << data_nodes << std::endl;
+  std::cout << "# Query Nodes " << query_nodes << std::endl;
+  benchmarkDevice(sycl::cpu_selector_v, data_nodes, query_nodes, repetitions);
+  benchmarkDevice(sycl::gpu_selector_v, data_nodes, query_nodes, repetitions);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2025 University of Salerno
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Microbenchmark of the query-domain filter kernel:
+// one atomic OR per (query node, data node) hit vs. the sub-group ballot that writes each candidate word once.
+// Usage: bench_filter <query_file> <data_file> [repetitions]
+
+#include <iostream>
+#include <sigmo.hpp>
+#include <string>
+#include <sycl/sycl.hpp>
+#include <vector>
+
+class FilterAtomicKernel;
+
+std::chrono::duration<double> runAtomicFilter(sycl::queue& queue,
+                                              sigmo::DeviceBatchedCSRGraph& query_graph,
+                                              sigmo::DeviceBatchedCSRGraph& data_graph,
+                                              sigmo::candidates::Candidates& candidates) {
+  size_t total_query_nodes = query_graph.total_nodes;
+  size_t total_positions = candidates.getCandidatesDevice().target_nodes;
+  sycl::range<1> local_range{sigmo::device::deviceOptions.filter_work_group_size};
+  sycl::range<1> global_range{((total_positions + local_range[0] - 1) / local_range[0]) * local_range[0]};
+
+  auto e = queue.submit([&](sycl::handler& cgh) {
+    cgh.parallel_for<FilterAtomicKernel>(
+        sycl::nd_range<1>({global_range, local_range}), [=, candidates = candidates.getCandidatesDevice()](sycl::nd_item<1> item) {
+          auto position = item.get_global_id(0);
+          if (position >= total_positions) { return; }
+          auto data_node_id = candidates.getNodeAt(position);
+          if (data_node_id == sigmo::types::NULL_NODE) { return; }
+          for (size_t query_node_id = 0; query_node_id < total_query_nodes; ++query_node_id) {
+            auto query_label = query_graph.node_labels[query_node_id];
+            if (query_label != data_graph.node_labels[data_node_id] && query_label != sigmo::types::WILDCARD_NODE) { continue; }
+            candidates.atomicInsert(query_node_id, position);
+          }
+        });
+  });
+  e.wait();
+  sigmo::utils::BatchedEvent be;
+  be.add(e);
+  return be.getProfilingInfo();
+}
+
+template<typename Selector>
+void benchmarkDevice(const Selector& selector, const std::string& query_file, const std::string& data_file, size_t repetitions) {
+  sycl::queue queue;
+  try {
+    queue = sycl::queue{selector, sycl::property::queue::enable_profiling{}};
+  } catch (sycl::exception& e) {
+    std::cout << "Device not available, skipping" << std::endl;
+    return;
+  }
+  std::cout << "------------- " << queue.get_device().get_info<sycl::info::device::name>() << " -------------" << std::endl;
+
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(query_file);
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(data_file);
+  auto device_query_graph = sigmo::createDeviceCSRGraph(queue, query_graphs);
+  auto device_data_graph = sigmo::createDeviceCSRGraph(queue, data_graphs);
+  sigmo::signature::Signature<> signatures{queue, device_data_graph.total_nodes, device_query_graph.total_nodes};
+
+  std::chrono::duration<double> atomic_time{0}, ballot_time{0};
+  bool mismatch = false;
+  for (size_t r = 0; r < repetitions; ++r) {
+    sigmo::candidates::Candidates atomic_candidates{queue, device_query_graph.total_nodes, device_data_graph};
+    sigmo::candidates::Candidates ballot_candidates{queue, device_query_graph.total_nodes, device_data_graph};
+    atomic_time += runAtomicFilter(queue, device_query_graph, device_data_graph, atomic_candidates);
+    auto e = sigmo::isomorphism::filter::filterCandidates(queue, device_query_graph, device_data_graph, signatures, ballot_candidates);
+    e.wait();
+    ballot_time += e.getProfilingInfo();
+    if (r == 0) { mismatch = atomic_candidates.getQueryCandidatesCount() != ballot_candidates.getQueryCandidatesCount(); }
+  }
+
+  double pairs = static_cast<double>(device_query_graph.total_nodes) * device_data_graph.total_nodes * repetitions;
+  std::cout << "Atomic: " << std::chrono::duration_cast<std::chrono::milliseconds>(atomic_time).count() << " ms ("
+            << pairs / atomic_time.count() / 1e9 << " Gpairs/s)" << std::endl;
+  std::cout << "Ballot: " << std::chrono::duration_cast<std::chrono::milliseconds>(ballot_time).count() << " ms ("
+            << pairs / ballot_time.count() / 1e9 << " Gpairs/s)" << std::endl;
+  std::cout << "Speedup: " << atomic_time.count() / ballot_time.count() << "x" << std::endl;
+  if (mismatch) { std::cout << "[!] Mismatch between the candidate sets" << std::endl; }
+
+  sigmo::destroyDeviceCSRGraph(device_data_graph, queue);
+  sigmo::destroyDeviceCSRGraph(device_query_graph, queue);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <query_file> <data_file> [repetitions]" << std::endl;
+    return 1;
+  }
+  size_t repetitions = argc > 3 ? std::stoul(argv[3]) : 5;
+
+  benchmarkDevice(sycl::cpu_selector_v, argv[1], argv[2], repetitions);
+  benchmarkDevice(sycl::gpu_selector_v, argv[1], argv[2], repetitions);
+}
@@ -5,30 +5,213 @@
 
 #pragma once
 #include "device.hpp"
+#include "graph.hpp"
 #include "types.hpp"
+#include "utils.hpp"
 #include <cstdint>
 #include <sycl/sycl.hpp>
+#include <type_traits>
+#include <vector>
 
 namespace sigmo {
 namespace candidates {
+namespace detail {
+
+/**
+ * Count the set bits of a word-aligned bitmap slice.
+ */
+SYCL_EXTERNAL inline uint32_t countBits(const uint64_t* words, uint32_t num_words) {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < num_words; ++i) { count += sycl::popcount(words[i]); }
+  return count;
+}
+
+/**
+ * Get the position of the set bit number idx of a word-aligned bitmap slice, or -1 if out of range.
+ */
+SYCL_EXTERNAL inline uint32_t findBit(const uint64_t* words, uint32_t num_words, uint32_t idx) {
+  for (uint32_t i = 0; i < num_words; ++i) {
+    uint64_t block = words[i];
+    uint32_t block_count = sycl::popcount(block);
+    if (idx < block_count) {
+      for (; idx > 0; --idx) { block &= block - 1; }
+      return i * 64 + sycl::ctz(block);
+    }
+    idx -= block_count;
+  }
+  return static_cast<uint32_t>(-1);
+}
+
+} // namespace detail
+
 class Candidates {
 public:
   struct CandidatesDevice {
     types::candidates_t* candidates;
     constexpr static types::candidates_t num_bits = sizeof(types::candidates_t) * 8;
+    constexpr static uint32_t slice_alignment = sizeof(uint64_t) * 8;
     size_t source_nodes;
-    size_t target_nodes;
+    size_t target_nodes; // number of bit positions of a source node, padding included
     size_t single_node_size;
+    CandidatesLayout layout = CandidatesLayout::Packed;
+    CandidatesDomain domain = CandidatesDomain::Query; // Data: source nodes are data nodes, target nodes are query nodes
+    types::node_t* slice_offsets = nullptr;  // first bit position of each data graph (Aligned only)
+    types::node_t* position_nodes = nullptr; // data node stored at each bit position, NULL_NODE for padding (Aligned only)
+    uint32_t* summary = nullptr;             // one bit per (data graph, query node): the query node has a candidate in the data graph
+    uint32_t summary_words = 0;              // summary words per data graph
+
+    /**
+     * View over the candidates of a single (query graph, data graph) pair.
+     * Resolves the slice position once so that per-query-node accesses inside the join do not rebuild edge masks.
+     */
+    struct GraphSlice {
+      const types::candidates_t* candidates;
+      size_t single_node_size;
+      uint32_t query_offset;
+      uint32_t graph_start;
+      uint32_t graph_end;
+      uint32_t slice_start;
+      bool aligned;
+      bool transposed;
 
-    CandidatesDevice() : source_nodes(0), target_nodes(0), single_node_size(0) {}
+      /**
+       * Get the number of candidates of a (graph local) query node in the data graph.
+       */
+      SYCL_EXTERNAL uint32_t getCandidatesCount(types::node_t query_node) const {
+        if (transposed) { return getTransposedCandidatesCount(query_node); }
+        if (!aligned) { return getPackedCandidatesCount(query_node); }
+        return detail::countBits(getAlignedWords(query_node), getAlignedWordsCount());
+      }
+
+      /**
+       * Get the candidate in position idx of a (graph local) query node, as a global data node id.
+       */
+      SYCL_EXTERNAL types::node_t getCandidateAt(types::node_t query_node, uint32_t idx) const {
+        if (transposed) { return getTransposedCandidateAt(query_node, idx); }
+        if (!aligned) { return getPackedCandidateAt(query_node, idx); }
+        uint32_t bit = detail::findBit(getAlignedWords(query_node), getAlignedWordsCount(), idx);
+        return bit == static_cast<uint32_t>(-1) ? static_cast<types::node_t>(-1) : graph_start + bit;
+      }
+
+      /**
+       * Get the 64 candidates of a (graph local) query node starting at data node graph_start + 64 * word.
+       */
+      SYCL_EXTERNAL uint64_t getCandidatesWord(types::node_t query_node, uint32_t word) const {
+        if (transposed) { return getTransposedCandidatesWord(query_node, word); }
+        if (aligned) { return getAlignedWords(query_node)[word]; }
+        const types::candidates_t* row = candidates + (query_offset + query_node) * single_node_size;
+        uint32_t first = graph_start + word * slice_alignment;
+        uint32_t idx = first / num_bits;
+        uint32_t shift = first % num_bits;
+        uint64_t bits = row[idx] >> shift;
+        if (idx + 1 < single_node_size) { bits |= static_cast<uint64_t>(row[idx + 1]) << (num_bits - shift); }
+        if (shift > 0 && idx + 2 < single_node_size) { bits |= static_cast<uint64_t>(row[idx + 2]) << (2 * num_bits - shift); }
+        uint32_t remaining = graph_end - first;
+        return remaining >= slice_alignment ? bits : bits & ((static_cast<uint64_t>(1) << remaining) - 1);
+      }
+
+    private:
+      SYCL_EXTERNAL uint32_t getAlignedWordsCount() const { return (graph_end - graph_start + slice_alignment - 1) / slice_alignment; }
+
+      // Aligned slices start on a 64-bit boundary and padding bits are never set, so no edge mask is needed.
+      SYCL_EXTERNAL const uint64_t* getAlignedWords(types::node_t query_node) const {
+        return reinterpret_cast<const uint64_t*>(candidates + (query_offset + query_node) * single_node_size + slice_start / num_bits);
+      }
+
+      SYCL_EXTERNAL uint32_t getPackedCandidatesCount(types::node_t query_node) const {
+        return countInRange(candidates + (query_offset + query_node) * single_node_size, graph_start, graph_end);
+      }
+
+      SYCL_EXTERNAL types::node_t getPackedCandidateAt(types::node_t query_node, uint32_t idx) const {
+        return findInRange(candidates + (query_offset + query_node) * single_node_size, idx, graph_start, graph_end);
+      }
+
+      // Data-major rows belong to data nodes: the candidates of a query node are a bit column over the data graph rows.
+      SYCL_EXTERNAL bool containsTransposed(uint32_t data_node, types::node_t query_node) const {
+        uint32_t bit = query_offset + query_node;
+        return candidates[data_node * single_node_size + bit / num_bits] & (static_cast<types::candidates_t>(1) << (bit % num_bits));
+      }
+
+      SYCL_EXTERNAL uint32_t getTransposedCandidatesCount(types::node_t query_node) const {
+        uint32_t count = 0;
+        for (uint32_t n = graph_start; n < graph_end; ++n) { count += containsTransposed(n, query_node); }
+        return count;
+      }
+
+      SYCL_EXTERNAL types::node_t getTransposedCandidateAt(types::node_t query_node, uint32_t idx) const {
+        for (uint32_t n = graph_start; n < graph_end; ++n) {
+          if (containsTransposed(n, query_node) && idx-- == 0) { return n; }
+        }
+        return static_cast<types::node_t>(-1);
+      }
+
+      SYCL_EXTERNAL uint64_t getTransposedCandidatesWord(types::node_t query_node, uint32_t word) const {
+        uint64_t bits = 0;
+        uint32_t first = graph_start + word * slice_alignment;
+        uint32_t last = sycl::min(first + slice_alignment, graph_end);
+        for (uint32_t n = first; n < last; ++n) { bits |= static_cast<uint64_t>(containsTransposed(n, query_node)) << (n - first); }
+        return bits;
+      }
+    };
+
+    CandidatesDevice() : candidates(nullptr), source_nodes(0), target_nodes(0), single_node_size(0) {}
 
     CandidatesDevice(size_t source_nodes, size_t target_nodes)
-        : source_nodes(source_nodes), target_nodes(target_nodes), single_node_size((target_nodes + (num_bits - 1)) / num_bits) {}
+        : candidates(nullptr),
+          source_nodes(source_nodes),
+          target_nodes(target_nodes),
+          single_node_size((target_nodes + (num_bits - 1)) / num_bits) {}
 
     size_t getAllocationSize() const { return source_nodes * single_node_size; }
 
     void setDataCandidates(types::candidates_t* data_candidates) { candidates = data_candidates; }
 
+    /**
+     * Get the data node stored at a given bit position, or NULL_NODE if the position is padding.
+     */
+    SYCL_EXTERNAL types::node_t getNodeAt(size_t position) const {
+      return layout == CandidatesLayout::Aligned ? position_nodes[position] : static_cast<types::node_t>(position);
+    }
+
+    /**
+     * Get the view over the candidates of the query graph starting at query_offset in the data graph [graph_start, graph_end).
+     */
+    SYCL_EXTERNAL GraphSlice getGraphSlice(uint32_t query_offset, uint32_t data_graph_id, uint32_t graph_start, uint32_t graph_end) const {
+      bool aligned = layout == CandidatesLayout::Aligned;
+      return {candidates,
+              single_node_size,
+              query_offset,
+              graph_start,
+              graph_end,
+              aligned ? slice_offsets[data_graph_id] : graph_start,
+              aligned,
+              domain == CandidatesDomain::Data};
+    }
+
+    /**
+     * Check that every query node in [query_offset, query_offset + num_query_nodes) has a candidate in the data graph.
+     * Reads the summary bits when available, the candidates slice otherwise.
+     */
+    SYCL_EXTERNAL bool
+    hasCandidates(uint32_t query_offset, uint32_t num_query_nodes, uint32_t data_graph_id, uint32_t graph_start, uint32_t graph_end) const {
+      if (summary == nullptr) {
+        const auto slice = getGraphSlice(query_offset, data_graph_id, graph_start, graph_end);
+        for (uint32_t i = 0; i < num_query_nodes; i++) {
+          if (slice.getCandidatesCount(i) == 0) { return false; }
+        }
+        return true;
+      }
+      const uint32_t* row = summary + data_graph_id * summary_words;
+      for (uint32_t bit = query_offset, end = query_offset + num_query_nodes; bit < end;) {
+        uint32_t shift = bit % 32;
+        uint32_t len = sycl::min(32 - shift, end - bit);
+        uint32_t mask = (len == 32 ? ~static_cast<uint32_t>(0) : (static_cast<uint32_t>(1) << len) - 1) << shift;
+        if ((row[bit / 32] & mask) != mask) { return false; }
+        bit += len;
+      }
+      return true;
+    }
+
     SYCL_EXTERNAL void insert(types::node_t source_node, types::node_t candidate) const {
       types::candidates_t idx = candidate / num_bits;
       types::candidates_t offset = candidate % num_bits;
@@ -43,6 +226,25 @@ public:
       ref |= (static_cast<types::candidates_t>(1) << offset);
     }
 
+    /**
+     * Overwrite a whole word of a source node row. The caller must own every bit of the word.
+     */
+    SYCL_EXTERNAL void setWord(types::node_t source_node, size_t word, types::candidates_t bits) const {
+      candidates[source_node * this->single_node_size + word] = bits;
+    }
+
+    SYCL_EXTERNAL void atomicInsertWord(types::node_t source_node, size_t word, types::candidates_t bits) const {
+      sycl::atomic_ref<types::candidates_t, sycl::memory_order::relaxed, sycl::memory_scope::device> ref{
+          candidates[source_node * this->single_node_size + word]};
+      ref |= bits;
+    }
+
+    SYCL_EXTERNAL void atomicRemoveWord(types::node_t source_node, size_t word, types::candidates_t bits) const {
+      sycl::atomic_ref<types::candidates_t, sycl::memory_order::relaxed, sycl::memory_scope::device> ref{
+          candidates[source_node * this->single_node_size + word]};
+      ref &= ~bits;
+    }
+
     SYCL_EXTERNAL bool contains(types::node_t source_node, types::node_t candidate) const {
       types::candidates_t idx = candidate / num_bits;
       types::candidates_t offset = candidate % num_bits;
@@ -84,6 +286,13 @@ public:
      * Get the number of candidates for a given source node in a given range.
      */
     SYCL_EXTERNAL uint32_t getCandidatesCount(types::node_t source_node, uint32_t graph_start, uint32_t graph_end) const {
+      return countInRange(candidates + source_node * single_node_size, graph_start, graph_end);
+    }
+
+    /**
+     * Count the set bits of a source node row in the range [graph_start, graph_end).
+     */
+    SYCL_EXTERNAL static uint32_t countInRange(const types::candidates_t* row, uint32_t graph_start, uint32_t graph_end) {
       uint32_t count = 0;
       uint32_t start_idx = graph_start / num_bits;
       uint32_t end_idx = (graph_end + num_bits - 1) / num_bits;
@@ -97,7 +306,7 @@ public:
         } else if (i == end_idx - 1) {
           mask >>= (num_bits - (graph_end % num_bits));
         }
-        count += sycl::popcount(candidates[source_node * single_node_size + i] & mask);
+        count += sycl::popcount(row[i] & mask);
       }
 
       return count;
@@ -130,6 +339,13 @@ public:
      * Get the candidate in position idx of a query node in a given range.
      */
     SYCL_EXTERNAL types::node_t getCandidateAt(types::node_t source_node, uint32_t idx, uint32_t graph_start, uint32_t graph_end) const {
+      return findInRange(candidates + source_node * single_node_size, idx, graph_start, graph_end);
+    }
+
+    /**
+     * Get the set bit in position idx of a source node row in the range [graph_start, graph_end).
+     */
+    SYCL_EXTERNAL static types::node_t findInRange(const types::candidates_t* row, uint32_t idx, uint32_t graph_start, uint32_t graph_end) {
       uint32_t count = 0;
       uint32_t start_idx = graph_start / num_bits;
       uint32_t end_idx = (graph_end + num_bits - 1) / num_bits;
@@ -144,7 +360,7 @@ public:
           mask >>= (num_bits - (graph_end % num_bits));
         }
 
-        types::candidates_t candidates_block = candidates[source_node * single_node_size + i] & mask;
+        types::candidates_t candidates_block = row[i] & mask;
         uint32_t block_count = sycl::popcount(candidates_block);
         if (count + block_count > idx) {
           while (candidates_block != 0) {
@@ -163,22 +379,40 @@ public:
   }; // struct CandidatesDevice
 
   Candidates(sycl::queue& queue, size_t source_nodes, size_t target_nodes)
-      : queue(queue), candidates(source_nodes, target_nodes), host_candidates(source_nodes, target_nodes) {
-    size_t alloc_size = candidates.getAllocationSize();
-    candidates.candidates = sycl::malloc_device<types::candidates_t>(alloc_size, queue);
-    size_t limit = 4194304;
-    sycl::range<1> range(alloc_size < limit ? alloc_size : limit);
+      : queue(queue), candidates(source_nodes, target_nodes), host_candidates(source_nodes, target_nodes), data_nodes(target_nodes) {
+    initialize();
+  }
 
-    queue
-        .submit([&](sycl::handler& cgh) {
-          cgh.parallel_for(range, [=, candidates = this->candidates](sycl::item<1> item) {
-            for (size_t i = item.get_id(0); i < alloc_size; i += item.get_range(0)) candidates.candidates[i] = 0;
-          });
-        })
-        .wait();
+  /**
+   * Create the candidates of the query nodes over the given data graphs.
+   * With the Aligned layout every data graph slice starts on a 64-bit word, so molecules up to 64 atoms are read with a single load.
+   * With the Data domain rows are indexed by data node and hold one bit per query node, the layout is ignored.
+   */
+  Candidates(sycl::queue& queue,
+             size_t query_nodes,
+             const DeviceBatchedCSRGraph& data_graphs,
+             CandidatesLayout layout = CandidatesLayout::Packed,
+             CandidatesDomain domain = CandidatesDomain::Query)
+      : queue(queue), data_nodes(data_graphs.total_nodes) {
+    if (domain == CandidatesDomain::Data) {
+      candidates = host_candidates = CandidatesDevice(data_nodes, query_nodes);
+      candidates.domain = host_candidates.domain = CandidatesDomain::Data;
+    } else {
+      candidates = host_candidates = CandidatesDevice(query_nodes, data_nodes);
+      if (layout == CandidatesLayout::Aligned) { initializeAlignedSlices(data_graphs); }
+    }
+    num_summary_graphs = data_graphs.num_graphs;
+    candidates.summary_words = (query_nodes + 31) / 32;
+    summary = device::memory::malloc<uint32_t>(num_summary_graphs * candidates.summary_words, queue);
+    queue.fill(summary, 0, num_summary_graphs * candidates.summary_words);
+    initialize();
   }
+
   ~Candidates() {
     sycl::free(candidates.candidates, queue);
+    if (candidates.slice_offsets != nullptr) sycl::free(candidates.slice_offsets, queue);
+    if (candidates.position_nodes != nullptr) sycl::free(candidates.position_nodes, queue);
+    if (summary != nullptr) sycl::free(summary, queue);
     if (host_candidates.candidates != nullptr) delete[] host_candidates.candidates;
   }
 
@@ -190,17 +424,499 @@ public:
   }
 
   size_t getCandidatesCount(types::node_t source_node) const { return candidates.getCandidatesCount(source_node); }
+  /**
+   * Get the number of candidates of every query node, whatever the domain.
+   */
+  std::vector<size_t> getQueryCandidatesCount() {
+    auto host = getHostCandidates();
+    if (host.domain == CandidatesDomain::Query) {
+      std::vector<size_t> counts(host.source_nodes);
+      for (size_t i = 0; i < host.source_nodes; ++i) { counts[i] = host.getCandidatesCount(i); }
+      return counts;
+    }
+    std::vector<size_t> counts(host.target_nodes, 0);
+    for (size_t i = 0; i < host.source_nodes * host.single_node_size; ++i) {
+      for (types::candidates_t block = host.candidates[i]; block != 0; block &= block - 1) {
+        counts[(i % host.single_node_size) * host.num_bits + sycl::ctz(block)]++;
+      }
+    }
+    return counts;
+  }
   size_t getCandidatesCount(types::node_t source_node, uint32_t graph_start, uint32_t graph_end) const {
     return candidates.getCandidatesCount(source_node, graph_start, graph_end);
   }
-  size_t getAllocationSize() const { return candidates.getAllocationSize() * sizeof(types::candidates_t); }
+  size_t getAllocationSize() const {
+    size_t alloc = candidates.getAllocationSize() * sizeof(types::candidates_t);
+    if (candidates.layout == CandidatesLayout::Aligned) { alloc += (num_slices + 1 + candidates.target_nodes) * sizeof(types::node_t); }
+    alloc += num_summary_graphs * candidates.summary_words * sizeof(uint32_t);
+    return alloc;
+  }
+
+  /**
+   * Build the summary bits once the bitmap is final, i.e. right before the GMCR or the compact pairs read them.
+   * Each work-item writes the word of 32 query nodes of a data graph, so no atomics are needed. Until the next
+   * invalidateSummary the built summary is reused and the returned event is the one of the build.
+   */
+  sycl::event buildSummary(const DeviceBatchedCSRGraph& data_graphs, const std::vector<sycl::event>& depends = {}) {
+    if (summary == nullptr || candidates.summary != nullptr) { return summary_event; }
+    const size_t num_query_nodes = candidates.domain == CandidatesDomain::Query ? candidates.source_nodes : candidates.target_nodes;
+    summary_event = queue.submit([&](sycl::handler& cgh) {
+      cgh.depends_on(depends);
+      cgh.parallel_for(sycl::range<2>(num_summary_graphs, candidates.summary_words),
+                       [=, candidates = this->candidates, summary = this->summary, data_graphs = data_graphs](sycl::id<2> idx) {
+                         const uint32_t data_graph_id = idx[0];
+                         const uint32_t word_id = idx[1];
+                         const auto slice = candidates.getGraphSlice(
+                             0, data_graph_id, data_graphs.graph_offsets[data_graph_id], data_graphs.graph_offsets[data_graph_id + 1]);
+                         uint32_t word = 0;
+                         for (uint32_t bit = 0; bit < 32 && word_id * 32 + bit < num_query_nodes; ++bit) {
+                           if (slice.getCandidatesCount(word_id * 32 + bit) > 0) { word |= static_cast<uint32_t>(1) << bit; }
+                         }
+                         summary[data_graph_id * candidates.summary_words + word_id] = word;
+                       });
+    });
+    candidates.summary = summary;
+    return summary_event;
+  }
+  /**
+   * Called by the filter and refine steps: the bitmap changed, readers fall back to the slices until the next build.
+   */
+  void invalidateSummary() { candidates.summary = nullptr; }
+  /**
+   * Get the bytes spent on bitmap padding to keep data graph slices word aligned.
+   */
+  size_t getPaddingSize() const {
+    if (candidates.domain == CandidatesDomain::Data) { return 0; }
+    return (candidates.target_nodes - data_nodes) * candidates.source_nodes / 8;
+  }
+  CandidatesLayout getLayout() const { return candidates.layout; }
+  CandidatesDomain getDomain() const { return candidates.domain; }
+  /**
+   * Free the dense bitmap once it has been compacted into PairCandidates.
+   */
+  void release() {
+    sycl::free(candidates.candidates, queue);
+    candidates.candidates = nullptr;
+  }
   Candidates::CandidatesDevice getCandidatesDevice() const { return candidates; }
 
 private:
   sycl::queue& queue;
   CandidatesDevice candidates;
   CandidatesDevice host_candidates;
+  size_t data_nodes;
+  size_t num_slices = 0;
+  size_t num_summary_graphs = 0;
+  uint32_t* summary = nullptr; // storage of candidates.summary, which is only set while the bits are up to date
+  sycl::event summary_event;
+
+  /**
+   * Slice offsets of the Aligned layout, computed on the device: the padded size of every data graph, scanned in place.
+   * Only the total number of positions is read back, to size the bitmap.
+   */
+  void initializeAlignedSlices(const DeviceBatchedCSRGraph& data_graphs) {
+    num_slices = data_graphs.num_graphs;
+    const uint32_t alignment = CandidatesDevice::slice_alignment;
+    auto slice_offsets = device::memory::malloc<types::node_t>(num_slices + 1, queue);
+    auto sizes_e = queue.parallel_for(sycl::range<1>(num_slices + 1), [=, graph_offsets = data_graphs.graph_offsets](sycl::id<1> idx) {
+      const size_t g = idx[0];
+      if (g == 0) {
+        slice_offsets[0] = 0;
+        return;
+      }
+      const uint32_t nodes = graph_offsets[g] - graph_offsets[g - 1];
+      slice_offsets[g] = ((nodes + alignment - 1) / alignment) * alignment;
+    });
+    auto scan_e = device::inclusiveScan(queue, slice_offsets + 1, num_slices, sizes_e);
+    types::node_t positions = 0;
+    queue.copy(slice_offsets + num_slices, &positions, 1, scan_e).wait();
+
+    auto position_nodes = device::memory::malloc<types::node_t>(positions, queue);
+    auto fill_e = queue.fill(position_nodes, types::NULL_NODE, positions);
+    queue
+        .parallel_for(sycl::range<1>(num_slices),
+                      fill_e,
+                      [=, graph_offsets = data_graphs.graph_offsets](sycl::id<1> idx) {
+                        const size_t g = idx[0];
+                        for (types::node_t n = graph_offsets[g]; n < graph_offsets[g + 1]; ++n) {
+                          position_nodes[slice_offsets[g] + n - graph_offsets[g]] = n;
+                        }
+                      })
+        .wait();
+
+    candidates = CandidatesDevice(candidates.source_nodes, positions);
+    host_candidates = CandidatesDevice(host_candidates.source_nodes, positions);
+    candidates.layout = host_candidates.layout = CandidatesLayout::Aligned;
+    candidates.slice_offsets = slice_offsets;
+    candidates.position_nodes = position_nodes;
+  }
+
+  void initialize() {
+    size_t alloc_size = candidates.getAllocationSize();
+    candidates.candidates = sycl::malloc_device<types::candidates_t>(alloc_size, queue);
+    size_t limit = 4194304;
+    sycl::range<1> range(alloc_size < limit ? alloc_size : limit);
+
+    queue
+        .submit([&](sycl::handler& cgh) {
+          cgh.parallel_for(range, [=, candidates = this->candidates](sycl::item<1> item) {
+            for (size_t i = item.get_id(0); i < alloc_size; i += item.get_range(0)) candidates.candidates[i] = 0;
+          });
+        })
+        .wait();
+  }
 
 }; // class Candidates
+
+/**
+ * Pick the candidates domain of a workload.
+ * Data-major rows are private to a data node, so filter and refine need neither atomics nor barriers, but every row spans all the
+ * query nodes: the layout pays off while the query nodes are few and largely outnumbered by the data nodes.
+ */
+inline CandidatesDomain selectCandidatesDomain(size_t query_nodes, size_t data_nodes) {
+  bool narrow_rows = query_nodes <= device::deviceOptions.data_domain_max_query_nodes;
+  bool many_data_nodes = query_nodes * device::deviceOptions.data_domain_min_ratio <= data_nodes;
+  return narrow_rows && many_data_nodes ? CandidatesDomain::Data : CandidatesDomain::Query;
+}
+
+/**
+ * Compact candidates storage produced after filtering.
+ * Only the (query graph, data graph) pairs where every query node has at least one candidate are kept, each one with
+ * ceil(data_graph_nodes / 64) words per query node, so memory scales with the surviving pairs instead of the full cross product.
+ * Pairs are grouped by data graph, in increasing query graph order as in the GMCR, and single node queries are skipped.
+ */
+class PairCandidates {
+public:
+  struct PairCandidatesDevice {
+    uint64_t* bitmaps = nullptr;
+    uint32_t* pair_offsets = nullptr;      // first bitmap word of each pair
+    uint32_t* pair_query_graphs = nullptr; // query graph of each pair
+    uint32_t* data_graph_pairs = nullptr;  // first pair of each data graph, size num_data_graphs + 1
+    size_t num_pairs = 0;
+    size_t num_words = 0;
+
+    struct GraphSlice {
+      const uint64_t* words;
+      uint32_t words_per_node;
+      uint32_t graph_start;
+
+      SYCL_EXTERNAL uint32_t getCandidatesCount(types::node_t query_node) const {
+        return detail::countBits(words + query_node * words_per_node, words_per_node);
+      }
+
+      SYCL_EXTERNAL types::node_t getCandidateAt(types::node_t query_node, uint32_t idx) const {
+        uint32_t bit = detail::findBit(words + query_node * words_per_node, words_per_node, idx);
+        return bit == static_cast<uint32_t>(-1) ? static_cast<types::node_t>(-1) : graph_start + bit;
+      }
+
+      SYCL_EXTERNAL uint64_t getCandidatesWord(types::node_t query_node, uint32_t word) const { return words[query_node * words_per_node + word]; }
+    };
+
+    SYCL_EXTERNAL GraphSlice getPairSlice(uint32_t pair_id, uint32_t graph_start, uint32_t graph_end) const {
+      return {bitmaps + pair_offsets[pair_id], (graph_end - graph_start + 63) / 64, graph_start};
+    }
+  };
+
+  PairCandidates(sycl::queue& queue) : queue(queue) {}
+  ~PairCandidates() {
+    sycl::free(pairs.bitmaps, queue);
+    sycl::free(pairs.pair_offsets, queue);
+    sycl::free(pairs.pair_query_graphs, queue);
+    sycl::free(pairs.data_graph_pairs, queue);
+  }
+
+  utils::BatchedEvent generatePairCandidates(DeviceBatchedCSRGraph& query_graphs, DeviceBatchedCSRGraph& data_graphs, Candidates& candidates) {
+    const size_t total_query_graphs = query_graphs.num_graphs;
+    const size_t total_data_graphs = data_graphs.num_graphs;
+    num_data_graphs = total_data_graphs;
+
+    const size_t flag_bits = sizeof(uint32_t) * 8;
+    const size_t flag_words = (total_query_graphs + flag_bits - 1) / flag_bits;
+
+    // pairs and bitmap words per data graph, turned into offsets by the prefix sums
+    uint32_t* data_graph_pairs = device::memory::malloc<uint32_t>(total_data_graphs + 1, queue);
+    uint32_t* data_graph_words = device::memory::malloc<uint32_t>(total_data_graphs + 1, queue);
+    uint32_t* pair_flags = device::memory::malloc<uint32_t>(total_data_graphs * flag_words, queue);
+    auto k0_pairs = queue.fill(data_graph_pairs, 0, total_data_graphs + 1);
+    auto k0_words = queue.fill(data_graph_words, 0, total_data_graphs + 1);
+    auto k0_summary = candidates.buildSummary(data_graphs);
+
+    // --- Kernel 1: flag the surviving pairs, 32 query graphs per work-item, and count them and their words per data graph ---
+    // Single node queries are skipped as in the GMCR, so compact and dense runs agree on the pairs.
+    auto k1 = queue.parallel_for(
+        sycl::range<2>(total_data_graphs, flag_words),
+        std::vector<sycl::event>{k0_pairs, k0_words, k0_summary},
+        [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice()](sycl::id<2> idx) {
+          const uint32_t data_graph_id = idx[0];
+          const uint32_t word_id = idx[1];
+          const uint32_t start_data = data_graphs.graph_offsets[data_graph_id];
+          const uint32_t end_data = data_graphs.graph_offsets[data_graph_id + 1];
+          const uint32_t words_per_node = (end_data - start_data + 63) / 64;
+          uint32_t flags = 0, words = 0;
+          for (uint32_t bit = 0; bit < flag_bits; bit++) {
+            const uint32_t query_graph_id = word_id * flag_bits + bit;
+            if (query_graph_id >= total_query_graphs) break;
+            const uint32_t num_query_nodes = query_graphs.getGraphNodes(query_graph_id);
+            if (num_query_nodes <= 1) continue;
+            if (candidates.hasCandidates(query_graphs.getPreviousNodes(query_graph_id), num_query_nodes, data_graph_id, start_data, end_data)) {
+              flags |= static_cast<uint32_t>(1) << bit;
+              words += num_query_nodes * words_per_node;
+            }
+          }
+          pair_flags[data_graph_id * flag_words + word_id] = flags;
+          if (flags != 0) {
+            sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device> pairs_ref(data_graph_pairs[data_graph_id + 1]);
+            sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device> words_ref(data_graph_words[data_graph_id + 1]);
+            pairs_ref.fetch_add(sycl::popcount(flags));
+            words_ref.fetch_add(words);
+          }
+        });
+
+    // --- Kernel 2: prefix sums of the pairs and words offsets ---
+    auto k2_pairs = device::inclusiveScan(queue, data_graph_pairs + 1, total_data_graphs, k1);
+    auto k2_words = device::inclusiveScan(queue, data_graph_words + 1, total_data_graphs, k1);
+
+    uint32_t num_pairs, num_words;
+    queue.copy(&data_graph_pairs[total_data_graphs], &num_pairs, 1, k2_pairs);
+    queue.copy(&data_graph_words[total_data_graphs], &num_words, 1, k2_words);
+    queue.wait();
+    pairs.num_pairs = num_pairs;
+    pairs.num_words = num_words;
+    pairs.data_graph_pairs = data_graph_pairs;
+    pairs.pair_offsets = device::memory::malloc<uint32_t>(num_pairs, queue);
+    pairs.pair_query_graphs = device::memory::malloc<uint32_t>(num_pairs, queue);
+    pairs.bitmaps = device::memory::malloc<uint64_t>(num_words, queue);
+
+    // --- Kernel 3: assign the pair slots of every data graph in increasing query graph order ---
+    auto k3 = queue.parallel_for(
+        sycl::range<1>(total_data_graphs),
+        std::vector<sycl::event>{k2_pairs, k2_words},
+        [=, query_graphs = query_graphs, data_graphs = data_graphs, pairs = pairs](sycl::id<1> idx) {
+          const uint32_t data_graph_id = idx[0];
+          const uint32_t words_per_node = (data_graphs.graph_offsets[data_graph_id + 1] - data_graphs.graph_offsets[data_graph_id] + 63) / 64;
+          uint32_t pair_id = data_graph_pairs[data_graph_id];
+          uint32_t word_offset = data_graph_words[data_graph_id];
+          for (uint32_t word_id = 0; word_id < flag_words; word_id++) {
+            for (uint32_t flags = pair_flags[data_graph_id * flag_words + word_id]; flags != 0; flags &= flags - 1) {
+              const uint32_t query_graph_id = word_id * flag_bits + sycl::ctz(flags);
+              pairs.pair_query_graphs[pair_id] = query_graph_id;
+              pairs.pair_offsets[pair_id++] = word_offset;
+              word_offset += query_graphs.getGraphNodes(query_graph_id) * words_per_node;
+            }
+          }
+        });
+
+    // --- Kernel 4: copy the data graph slices of the dense bitmap, one work-item per pair ---
+    auto k4 = queue.parallel_for(
+        sycl::range<1>(num_pairs),
+        k3,
+        [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice(), pairs = pairs](sycl::id<1> idx) {
+          const uint32_t pair_id = idx[0];
+          const uint32_t data_graph_id = utils::binarySearch(pairs.data_graph_pairs, total_data_graphs, pair_id);
+          const uint32_t start_data = data_graphs.graph_offsets[data_graph_id];
+          const uint32_t end_data = data_graphs.graph_offsets[data_graph_id + 1];
+          const uint32_t query_graph_id = pairs.pair_query_graphs[pair_id];
+          const uint32_t num_query_nodes = query_graphs.getGraphNodes(query_graph_id);
+          const auto slice = candidates.getGraphSlice(query_graphs.getPreviousNodes(query_graph_id), data_graph_id, start_data, end_data);
+          const uint32_t words_per_node = (end_data - start_data + 63) / 64;
+          const uint32_t word_offset = pairs.pair_offsets[pair_id];
+          for (uint32_t i = 0; i < num_query_nodes; i++) {
+            for (uint32_t w = 0; w < words_per_node; w++) { pairs.bitmaps[word_offset + i * words_per_node + w] = slice.getCandidatesWord(i, w); }
+          }
+        });
+    k4.wait();
+
+    sycl::free(pair_flags, queue);
+    sycl::free(data_graph_words, queue);
+
+    utils::BatchedEvent ret;
+    ret.add(k1);
+    ret.add(k2_pairs);
+    ret.add(k2_words);
+    ret.add(k3);
+    ret.add(k4);
+    return ret;
+  }
+
+  size_t getNumPairs() const { return pairs.num_pairs; }
+  size_t getAllocationSize() const {
+    return pairs.num_words * sizeof(uint64_t) + pairs.num_pairs * 2 * sizeof(uint32_t) + (num_data_graphs + 1) * sizeof(uint32_t);
+  }
+  PairCandidatesDevice getCandidatesDevice() const { return pairs; }
+
+private:
+  sycl::queue& queue;
+  PairCandidatesDevice pairs;
+  size_t num_data_graphs = 0;
+}; // class PairCandidates
+
+/**
+ * Candidate lists of the GMCR pairs, materialized once before the join.
+ * Every (pair, query node) list stores graph-local candidate ids in a single pooled buffer, so the join reads the
+ * candidate in position idx directly instead of re-scanning the bitmap from the slice start.
+ */
+class PairCandidateLists {
+public:
+  using local_node_t = uint16_t;
+
+  struct PairCandidateListsDevice {
+    local_node_t* candidates = nullptr; // pooled graph-local candidate ids
+    uint32_t* pair_lists = nullptr;     // first list of each pair, size num_pairs + 1
+    uint32_t* list_offsets = nullptr;   // first candidate of each list, size num_lists + 1
+    size_t num_pairs = 0;
+    size_t num_lists = 0;
+    size_t num_candidates = 0;
+
+    struct GraphSlice {
+      const local_node_t* candidates;
+      const uint32_t* offsets;
+      uint32_t graph_start;
+
+      SYCL_EXTERNAL uint32_t getCandidatesCount(types::node_t query_node) const { return offsets[query_node + 1] - offsets[query_node]; }
+
+      SYCL_EXTERNAL types::node_t getCandidateAt(types::node_t query_node, uint32_t idx) const {
+        if (idx >= getCandidatesCount(query_node)) { return static_cast<types::node_t>(-1); }
+        return graph_start + candidates[offsets[query_node] + idx];
+      }
+    };
+
+    SYCL_EXTERNAL GraphSlice getPairSlice(uint32_t pair_id, uint32_t graph_start, uint32_t graph_end) const {
+      return {candidates, list_offsets + pair_lists[pair_id], graph_start};
+    }
+  };
+
+  PairCandidateLists(sycl::queue& queue) : queue(queue) {}
+  ~PairCandidateLists() { release(); }
+
+  /**
+   * Materialize the lists of the GMCR entries from the candidates storage used to build it, the pair id is the GMCR position.
+   * Nothing is kept if the lists exceed max_bytes, isAvailable() tells whether the join can use them.
+   */
+  template<typename CandidatesT, typename GMCRDeviceT>
+  utils::BatchedEvent generateCandidateLists(DeviceBatchedCSRGraph& query_graphs,
+                                             DeviceBatchedCSRGraph& data_graphs,
+                                             CandidatesT& candidates,
+                                             const GMCRDeviceT& gmcr,
+                                             size_t max_bytes = device::deviceOptions.candidate_lists_max_bytes) {
+    release();
+    const size_t num_pairs = gmcr.total_query_indices;
+    const size_t total_data_graphs = data_graphs.num_graphs;
+    utils::BatchedEvent ret;
+    if (num_pairs == 0) { return ret; }
+    lists.num_pairs = num_pairs;
+
+    // --- Kernel 1: lists per pair, turned into offsets by the scan ---
+    uint32_t* pair_lists = device::memory::malloc<uint32_t>(num_pairs + 1, queue);
+    lists.pair_lists = pair_lists;
+    auto k0 = queue.fill(pair_lists, 0, 1);
+    auto k1 = queue.parallel_for(sycl::range<1>(num_pairs), k0, [=, query_graphs = query_graphs](sycl::id<1> idx) {
+      pair_lists[idx[0] + 1] = query_graphs.getGraphNodes(gmcr.query_graph_indices[idx[0]]);
+    });
+    ret.add(k1);
+    ret.add(device::inclusiveScan(queue, pair_lists + 1, num_pairs, k1));
+    uint32_t num_lists;
+    queue.copy(pair_lists + num_pairs, &num_lists, 1, ret.getLastEvent()).wait();
+    lists.num_lists = num_lists;
+
+    // --- Kernel 2: candidates per list, turned into offsets by the scan ---
+    uint32_t* list_offsets = device::memory::malloc<uint32_t>(num_lists + 1, queue);
+    lists.list_offsets = list_offsets;
+    auto k2_fill = queue.fill(list_offsets, 0, 1);
+    auto k2 = queue.parallel_for(
+        sycl::range<1>(num_pairs),
+        k2_fill,
+        [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice()](sycl::id<1> idx) {
+          const uint32_t pair_id = idx[0];
+          const uint32_t query_graph_id = gmcr.query_graph_indices[pair_id];
+          const uint32_t data_graph_id = utils::binarySearch(gmcr.data_graph_offsets, total_data_graphs, pair_id);
+          const auto slice = getSlice(candidates,
+                                      pair_id,
+                                      query_graphs.getPreviousNodes(query_graph_id),
+                                      data_graph_id,
+                                      data_graphs.graph_offsets[data_graph_id],
+                                      data_graphs.graph_offsets[data_graph_id + 1]);
+          for (uint32_t u = 0; u < query_graphs.getGraphNodes(query_graph_id); ++u) {
+            list_offsets[pair_lists[pair_id] + u + 1] = slice.getCandidatesCount(u);
+          }
+        });
+    ret.add(k2);
+    ret.add(device::inclusiveScan(queue, list_offsets + 1, num_lists, k2));
+    uint32_t num_candidates;
+    queue.copy(list_offsets + num_lists, &num_candidates, 1, ret.getLastEvent()).wait();
+    lists.num_candidates = num_candidates;
+
+    if (getAllocationSize() > max_bytes) {
+      release();
+      return ret;
+    }
+
+    // --- Kernel 3: enumerate the candidates of every list into the pool ---
+    local_node_t* pool = device::memory::malloc<local_node_t>(num_candidates, queue);
+    lists.candidates = pool;
+    auto k3 = queue.parallel_for(
+        sycl::range<1>(num_pairs),
+        [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice()](sycl::id<1> idx) {
+          const uint32_t pair_id = idx[0];
+          const uint32_t query_graph_id = gmcr.query_graph_indices[pair_id];
+          const uint32_t data_graph_id = utils::binarySearch(gmcr.data_graph_offsets, total_data_graphs, pair_id);
+          const uint32_t graph_start = data_graphs.graph_offsets[data_graph_id];
+          const uint32_t graph_end = data_graphs.graph_offsets[data_graph_id + 1];
+          const auto slice = getSlice(candidates, pair_id, query_graphs.getPreviousNodes(query_graph_id), data_graph_id, graph_start, graph_end);
+          const uint32_t num_words = (graph_end - graph_start + 63) / 64;
+          for (uint32_t u = 0; u < query_graphs.getGraphNodes(query_graph_id); ++u) {
+            uint32_t position = list_offsets[pair_lists[pair_id] + u];
+            for (uint32_t w = 0; w < num_words; ++w) {
+              for (uint64_t bits = slice.getCandidatesWord(u, w); bits != 0; bits &= bits - 1) {
+                pool[position++] = static_cast<local_node_t>(w * 64 + sycl::ctz(bits));
+              }
+            }
+          }
+        });
+    k3.wait();
+    ret.add(k3);
+    available = true;
+    return ret;
+  }
+
+  bool isAvailable() const { return available; }
+  size_t getNumCandidates() const { return lists.num_candidates; }
+  size_t getAllocationSize() const {
+    return lists.num_candidates * sizeof(local_node_t) + (lists.num_pairs + 1 + lists.num_lists + 1) * sizeof(uint32_t);
+  }
+  PairCandidateListsDevice getCandidatesDevice() const { return lists; }
+
+private:
+  sycl::queue& queue;
+  PairCandidateListsDevice lists;
+  bool available = false;
+
+  void release() {
+    if (lists.candidates != nullptr) sycl::free(lists.candidates, queue);
+    if (lists.pair_lists != nullptr) sycl::free(lists.pair_lists, queue);
+    if (lists.list_offsets != nullptr) sycl::free(lists.list_offsets, queue);
+    lists = PairCandidateListsDevice{};
+    available = false;
+  }
+}; // class PairCandidateLists
+
+/**
+ * Get the candidates view of a (query graph, data graph) pair, whatever the candidates storage.
+ * pair_id is the position of the pair in the GMCR, the dense storages locate the slice from the graphs instead.
+ */
+template<typename CandidatesDeviceT>
+SYCL_EXTERNAL inline auto getSlice(const CandidatesDeviceT& candidates,
+                                   uint32_t pair_id,
+                                   uint32_t query_offset,
+                                   uint32_t data_graph_id,
+                                   uint32_t graph_start,
+                                   uint32_t graph_end) {
+  if constexpr (std::is_same_v<CandidatesDeviceT, PairCandidates::PairCandidatesDevice>
+                || std::is_same_v<CandidatesDeviceT, PairCandidateLists::PairCandidateListsDevice>) {
+    return candidates.getPairSlice(pair_id, graph_start, graph_end);
+  } else {
+    return candidates.getGraphSlice(query_offset, data_graph_id, graph_start, graph_end);
+  }
+}
+
 } // namespace candidates
 } // namespace sigmo
\ No newline at end of file
@@ -5,20 +5,56 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 #include <sycl/sycl.hpp>
+#include <vector>
 
 namespace sigmo {
 
 
 enum class CandidatesDomain { Query, Data };
+enum class CandidatesLayout { Packed, Aligned };
 namespace device {
 
-static struct DeviceOptions {
+struct DeviceOptions {
   size_t join_work_group_size = 128;
   size_t filter_work_group_size = 512;
+  // query nodes staged per work-group by the tiled refine kernel, 0 falls back to the per-query staging kernel
+  size_t refine_query_tile = 32;
+  // memory budget of the cached per-pair candidate lists, the join falls back to the bitmaps above it
+  size_t candidate_lists_max_bytes = size_t{1} << 30;
+  // adaptive join: pairs per data graph worth a work-group, candidates of a query node worth a sub-group (find-all only)
+  size_t join_dense_pairs = 32;
+  size_t join_wide_candidates = 32;
+  // schedule data graphs heavy-first (pairs, nodes, candidate volume) instead of in file order
+  bool join_heavy_first = true;
+  // memory budget of a BFS join frontier, deeper levels are completed depth-first above it
+  size_t bfs_frontier_max_bytes = size_t{512} << 20;
+  // auto domain selection: data-major rows are used for at most this many query nodes, at least ratio data nodes per query node
+  size_t data_domain_max_query_nodes = 256;
+  size_t data_domain_min_ratio = 1024;
+};
+
+// options read by the host side of the kernels, per thread so that engines on different threads do not interfere
+inline thread_local DeviceOptions deviceOptions;
 
-} deviceOptions;
+/**
+ * Install a set of device options on the calling thread, restoring the previous ones on destruction.
+ */
+class ScopedDeviceOptions {
+public:
+  explicit ScopedDeviceOptions(const DeviceOptions& options) : previous(deviceOptions) { deviceOptions = options; }
+  ~ScopedDeviceOptions() { deviceOptions = previous; }
+  ScopedDeviceOptions(const ScopedDeviceOptions&) = delete;
+  ScopedDeviceOptions& operator=(const ScopedDeviceOptions&) = delete;
+
+private:
+  DeviceOptions previous;
+};
 
 inline size_t getDeviceMemorySize(sycl::queue& queue) {
   return queue.get_info<sycl::info::queue::device>().get_info<sycl::info::device::global_mem_size>();
@@ -26,8 +62,36 @@ inline size_t getDeviceMemorySize(sycl::queue& queue) {
 
 inline size_t getPreferredWorkGroupSize(sycl::queue& queue) { return queue.get_device().get_info<sycl::info::device::max_work_group_size>(); }
 
+/**
+ * Devices named by a specification: "gpu" for the default GPU, "all" for every GPU and CPU device, or a comma separated
+ * list of indices into sycl::device::get_devices().
+ */
+inline std::vector<sycl::device> selectDevices(const std::string& spec) {
+  if (spec == "gpu") { return {sycl::device{sycl::gpu_selector_v}}; }
+  auto platform_devices = sycl::device::get_devices();
+  std::vector<sycl::device> devices;
+  if (spec == "all") {
+    for (auto& device : platform_devices) {
+      if (device.is_gpu() || device.is_cpu()) { devices.push_back(device); }
+    }
+  } else {
+    std::stringstream indices{spec};
+    for (std::string index; std::getline(indices, index, ',');) {
+      size_t i = 0;
+      try {
+        i = std::stoul(index);
+      } catch (std::exception&) { throw std::runtime_error("Invalid device index: " + index); }
+      if (i >= platform_devices.size()) { throw std::runtime_error("Device index out of range: " + index); }
+      devices.push_back(platform_devices[i]);
+    }
+  }
+  if (devices.empty()) { throw std::runtime_error("No device matches " + spec); }
+  return devices;
+}
+
 namespace kernels {
 
+template<typename T>
 class PrefixSumKernel;
 class GenerateQuerySignaturesKernel;
 class RefineQuerySignaturesKernel;
@@ -38,12 +102,33 @@ template<CandidatesDomain D>
 class FilterCandidatesKernel;
 template<CandidatesDomain D>
 class RefineCandidatesKernel;
+class RefineCandidatesTiledKernel;
+template<typename CandidatesT>
 class JoinCandidatesKernel;
+template<typename CandidatesT>
 class JoinWildcardCandidatesKernel;
+template<typename CandidatesT, size_t MaxDepth>
 class JoinCandidates2Kernel;
+template<typename CandidatesT, size_t MaxDepth>
+class JoinCooperativeCandidatesKernel;
+class JoinTrieKernel;
 
 } // namespace kernels
 
+/**
+ * In-place inclusive scan of values[0..size) with a single work-group.
+ */
+template<typename T>
+inline sycl::event inclusiveScan(sycl::queue& queue, T* values, size_t size, sycl::event dependency) {
+  const size_t group_size = std::min<size_t>(getPreferredWorkGroupSize(queue), 1024);
+  return queue.submit([&](sycl::handler& cgh) {
+    cgh.depends_on(dependency);
+    cgh.parallel_for<kernels::PrefixSumKernel<T>>(sycl::nd_range<1>{group_size, group_size}, [=](sycl::nd_item<1> item) {
+      sycl::joint_inclusive_scan(item.get_group(), values, values + size, values, sycl::plus<T>());
+    });
+  });
+}
+
 namespace memory {
 
 enum class MemoryScope {
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2025 University of Salerno
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "candidates.hpp"
+#include "device.hpp"
+#include "gmcr.hpp"
+#include "graph.hpp"
+#include "isomorphism.hpp"
+#include "signature.hpp"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <sycl/sycl.hpp>
+#include <thread>
+#include <vector>
+
+namespace sigmo {
+
+struct EngineConfig {
+  size_t refinement_steps = 0;
+  bool find_all = false;
+  bool skip_join = false; // stop after the filter, the result only counts the query graphs
+  std::optional<CandidatesDomain> domain; // selected per query batch when empty
+  CandidatesLayout layout = CandidatesLayout::Packed;
+  isomorphism::join::JoinPolicy join_policy = isomorphism::join::JoinPolicy::Auto;
+  device::DeviceOptions device_options{};
+};
+
+struct QueryResult {
+  size_t matches = 0;
+  size_t pairs = 0; // (query graph, data graph) pairs surviving the filter
+  size_t query_graphs = 0;
+  std::chrono::duration<double> query_signature_time{0};
+  std::chrono::duration<double> filter_time{0};
+  std::chrono::duration<double> mapping_time{0};
+  std::chrono::duration<double> join_time{0};
+  std::chrono::duration<double> host_time{0}; // oversized graphs matched on the host, overlapping the device pipeline
+};
+
+/**
+ * The whole pipeline (signatures, filter, refinement, GMCR, join) over a resident set of data graphs.
+ * The data graphs and their signatures at every refinement level are computed once by loadData and reused by every
+ * runQueries call. An engine only touches its own queue and buffers, and installs its device options for the duration
+ * of its calls, so engines on different queues can run concurrently from different threads. A single engine is not
+ * meant to be shared between threads.
+ */
+class Engine {
+public:
+  using SignatureT = signature::Signature<>;
+
+  Engine(sycl::queue& queue, EngineConfig config = {})
+      : queue(queue), query_queue(queue.get_context(), queue.get_device(), sycl::property::queue::enable_profiling{}), config(std::move(config)) {
+    num_matches = sycl::malloc_shared<size_t>(1, queue);
+  }
+
+  Engine(const Engine&) = delete;
+  Engine& operator=(const Engine&) = delete;
+
+  ~Engine() {
+    releaseData();
+    sycl::free(num_matches, queue);
+  }
+
+  /**
+   * Upload the data graphs and compute their signatures, replacing the previously loaded ones.
+   */
+  void loadData(std::vector<CSRGraph>& data_graphs) {
+    device::ScopedDeviceOptions options{config.device_options};
+    releaseData();
+    graphs = createDeviceCSRGraph(queue, data_graphs);
+    loaded = true;
+
+    signatures = std::make_unique<SignatureT>(queue, query_queue, graphs.total_nodes, 1);
+    // every level is refined in place once its snapshot is taken, the host waits once for the whole chain
+    utils::StageGraph stages;
+    utils::StageGraph::StageId snapshot = 0;
+    for (size_t level = 0; level <= config.refinement_steps; ++level) {
+      auto signature = level == 0 ? stages.add("data_signatures", signatures->generateDataSignatures(graphs))
+                                  : stages.add("data_signatures", signatures->refineDataSignatures(graphs, level, stages.after({snapshot})));
+      levels.push_back(device::memory::malloc<SignatureT::SignatureDevice>(graphs.total_nodes, queue));
+      snapshot = stages.add("snapshot", utils::BatchedEvent{signatures->storeDataSignatures(levels.back(), stages.after({signature}))});
+    }
+    stages.wait();
+    data_signature_time = stages.getTotalTime("data_signatures");
+  }
+
+  /**
+   * Filter and join a batch of query graphs against the loaded data graphs.
+   */
+  QueryResult runQueries(std::vector<CSRGraph>& query_graphs) {
+    if (!loaded) { throw std::runtime_error("Engine::runQueries called before loadData"); }
+    device::ScopedDeviceOptions options{config.device_options};
+    QueryResult result;
+    result.query_graphs = query_graphs.size();
+    auto device_query_graph = createDeviceCSRGraph(queue, query_graphs);
+    const size_t query_nodes = device_query_graph.total_nodes;
+    const CandidatesDomain domain = config.domain.value_or(candidates::selectCandidatesDomain(query_nodes, graphs.total_nodes));
+
+    candidates::Candidates candidates{queue, query_nodes, graphs, config.layout, domain};
+    std::optional<isomorphism::mapping::GMCR> gmcr;
+    signatures->resetQuerySignatures(query_nodes);
+    // level l loads the data snapshot and refines the query signatures once the filter of level l - 1 has read them
+    utils::StageGraph stages;
+    utils::StageGraph::StageId filter_stage = 0;
+    for (size_t level = 0; level <= config.refinement_steps; ++level) {
+      const auto depends = level == 0 ? std::vector<sycl::event>{} : stages.after({filter_stage});
+      auto load = stages.add("load", utils::BatchedEvent{signatures->loadDataSignatures(levels[level], depends)});
+      auto signature = level == 0 ? stages.add("query_signatures", signatures->generateQuerySignatures(device_query_graph))
+                                  : stages.add("query_signatures", signatures->refineQuerySignatures(device_query_graph, level, depends));
+      filter_stage = stages.add("filter", filter(device_query_graph, candidates, domain, level == 0, stages.after({load, signature})));
+    }
+    if (!config.skip_join) {
+      gmcr.emplace(queue);
+      stages.add("mapping", gmcr->generateGMCR(device_query_graph, graphs, candidates, stages.after({filter_stage})));
+    }
+    stages.wait();
+    result.query_signature_time = stages.getTotalTime("query_signatures");
+    result.filter_time = stages.getTotalTime("filter");
+    result.mapping_time = stages.getTotalTime("mapping");
+
+    if (config.skip_join) {
+      destroyDeviceCSRGraph(device_query_graph, queue);
+      return result;
+    }
+    num_matches[0] = 0;
+    result.pairs = gmcr->getGMCRDevice().total_query_indices;
+    isomorphism::join::JoinDispatcher dispatcher{queue, config.join_policy};
+    auto join_e = dispatcher.run(device_query_graph, graphs, candidates, *gmcr, num_matches, !config.find_all);
+    join_e.wait();
+    result.join_time = join_e.getProfilingInfo();
+    result.matches = num_matches[0];
+
+    destroyDeviceCSRGraph(device_query_graph, queue);
+    return result;
+  }
+
+  bool isLoaded() const { return loaded; }
+  size_t getNumDataGraphs() const { return loaded ? graphs.num_graphs : 0; }
+  size_t getNumDataNodes() const { return loaded ? graphs.total_nodes : 0; }
+  std::chrono::duration<double> getDataSignatureTime() const { return data_signature_time; }
+  const EngineConfig& getConfig() const { return config; }
+
+private:
+  sycl::queue& queue;
+  sycl::queue query_queue; // query signatures, overlapping the data snapshot loads
+  EngineConfig config;
+  DeviceBatchedCSRGraph graphs{};
+  bool loaded = false;
+  std::unique_ptr<SignatureT> signatures;
+  std::vector<SignatureT::SignatureDevice*> levels; // data signatures after every refinement step
+  std::chrono::duration<double> data_signature_time{0};
+  size_t* num_matches;
+
+  utils::BatchedEvent filter(DeviceBatchedCSRGraph& query_graphs,
+                             candidates::Candidates& candidates,
+                             CandidatesDomain domain,
+                             bool first,
+                             const std::vector<sycl::event>& depends) {
+    using namespace isomorphism::filter;
+    if (domain == CandidatesDomain::Data) {
+      return first ? filterCandidates<CandidatesDomain::Data>(queue, query_graphs, graphs, *signatures, candidates, depends)
+                   : refineCandidates<CandidatesDomain::Data>(queue, query_graphs, graphs, *signatures, candidates, depends);
+    }
+    return first ? filterCandidates<CandidatesDomain::Query>(queue, query_graphs, graphs, *signatures, candidates, depends)
+                 : refineCandidates<CandidatesDomain::Query>(queue, query_graphs, graphs, *signatures, candidates, depends);
+  }
+
+  void releaseData() {
+    for (auto level : levels) { sycl::free(level, queue); }
+    levels.clear();
+    signatures.reset();
+    if (loaded) { destroyDeviceCSRGraph(graphs, queue); }
+    loaded = false;
+  }
+};
+
+/**
+ * One Engine per device over disjoint slices of the data graphs, run concurrently and merged.
+ * The data graphs are split in contiguous slices whose node counts follow the device weights, equal until calibrate
+ * measures the throughput of every device on a sample of the workload.
+ */
+class MultiDeviceEngine {
+public:
+  MultiDeviceEngine(const std::vector<sycl::device>& devices, EngineConfig config = {}) : config(std::move(config)) {
+    if (devices.empty()) { throw std::runtime_error("MultiDeviceEngine needs at least one device"); }
+    queues.reserve(devices.size()); // the engines keep a reference to their queue
+    for (auto& device : devices) { queues.emplace_back(device, sycl::property::queue::enable_profiling{}); }
+    for (auto& queue : queues) { engines.push_back(std::make_unique<Engine>(queue, this->config)); }
+    weights.assign(devices.size(), 1.0);
+    offsets.assign(devices.size() + 1, 0);
+    results.resize(devices.size());
+  }
+
+  /**
+   * Set the device weights to the data nodes per second each device sustains on the first sample_graphs data graphs.
+   * The devices are measured one at a time, after a warm-up run that absorbs the kernel compilation.
+   */
+  void calibrate(std::vector<CSRGraph>& query_graphs, std::vector<CSRGraph>& data_graphs, size_t sample_graphs = 4096) {
+    std::vector<CSRGraph> sample{data_graphs.begin(), data_graphs.begin() + std::min(sample_graphs, data_graphs.size())};
+    size_t sample_nodes = 0;
+    for (auto& graph : sample) { sample_nodes += graph.getNumNodes(); }
+    for (size_t i = 0; i < queues.size(); ++i) {
+      Engine engine{queues[i], config};
+      engine.loadData(sample);
+      engine.runQueries(query_graphs);
+      auto start = std::chrono::steady_clock::now();
+      engine.loadData(sample);
+      engine.runQueries(query_graphs);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      weights[i] = elapsed.count() > 0 ? sample_nodes / elapsed.count() : 1.0;
+    }
+  }
+
+  /**
+   * Split the data graphs by the device weights and load every slice on its device.
+   */
+  void loadData(std::vector<CSRGraph>& data_graphs) {
+    partition(data_graphs);
+    forEachDevice([&](size_t i) {
+      std::vector<CSRGraph> slice{data_graphs.begin() + offsets[i], data_graphs.begin() + offsets[i + 1]};
+      if (slice.empty()) {
+        engines[i] = std::make_unique<Engine>(queues[i], config); // a device too slow for a single data graph
+        return;
+      }
+      engines[i]->loadData(slice);
+    });
+  }
+
+  /**
+   * Run the query batch on every device and merge the results, the times are the ones of the slowest device.
+   */
+  QueryResult runQueries(std::vector<CSRGraph>& query_graphs) {
+    forEachDevice([&](size_t i) {
+      auto local_query_graphs = query_graphs;
+      results[i] = engines[i]->isLoaded() ? engines[i]->runQueries(local_query_graphs) : QueryResult{};
+    });
+    QueryResult merged;
+    merged.query_graphs = query_graphs.size();
+    for (auto& result : results) {
+      merged.matches += result.matches;
+      merged.pairs += result.pairs;
+      merged.query_signature_time = std::max(merged.query_signature_time, result.query_signature_time);
+      merged.filter_time = std::max(merged.filter_time, result.filter_time);
+      merged.mapping_time = std::max(merged.mapping_time, result.mapping_time);
+      merged.join_time = std::max(merged.join_time, result.join_time);
+    }
+    return merged;
+  }
+
+  size_t getNumDevices() const { return queues.size(); }
+  sycl::device getDevice(size_t i) const { return queues[i].get_device(); }
+  double getWeight(size_t i) const { return weights[i]; }
+  size_t getNumDataGraphs(size_t i) const { return offsets[i + 1] - offsets[i]; }
+  const QueryResult& getDeviceResult(size_t i) const { return results[i]; }
+
+private:
+  EngineConfig config;
+  std::vector<sycl::queue> queues;
+  std::vector<std::unique_ptr<Engine>> engines;
+  std::vector<double> weights;
+  std::vector<size_t> offsets; // first data graph of every slice
+  std::vector<QueryResult> results;
+
+  void partition(const std::vector<CSRGraph>& data_graphs) {
+    size_t total_nodes = 0;
+    for (auto& graph : data_graphs) { total_nodes += graph.getNumNodes(); }
+    double total_weight = 0;
+    for (auto weight : weights) { total_weight += weight; }
+
+    double target = 0;
+    size_t graph = 0, nodes = 0;
+    for (size_t i = 0; i < queues.size(); ++i) {
+      offsets[i] = graph;
+      target += total_nodes * weights[i] / total_weight;
+      while (graph < data_graphs.size() && (i + 1 == queues.size() || nodes + data_graphs[graph].getNumNodes() / 2.0 <= target)) {
+        nodes += data_graphs[graph++].getNumNodes();
+      }
+    }
+    offsets[queues.size()] = data_graphs.size();
+  }
+
+  template<typename Fn>
+  void forEachDevice(Fn&& fn) {
+    std::vector<std::exception_ptr> errors(queues.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < queues.size(); ++i) {
+      threads.emplace_back([&, i]() {
+        try {
+          fn(i);
+        } catch (...) { errors[i] = std::current_exception(); }
+      });
+    }
+    for (auto& thread : threads) { thread.join(); }
+    for (auto& error : errors) {
+      if (error) { std::rethrow_exception(error); }
+    }
+  }
+};
+
+} // namespace sigmo
@@ -19,7 +19,7 @@ private:
     uint32_t* data_graph_offsets;
     uint32_t* query_graph_indices;
     size_t total_query_indices;
-  } gmcr;
+  } gmcr{};
   sycl::queue& queue;
 
 public:
@@ -29,96 +29,91 @@ public:
     sycl::free(gmcr.query_graph_indices, queue);
   }
 
-  // Offloaded version of generateGMCR using SYCL kernels.
-  utils::BatchedEvent
-  generateGMCR(sigmo::DeviceBatchedCSRGraph& query_graphs, sigmo::DeviceBatchedCSRGraph& data_graphs, sigmo::candidates::Candidates& candidates) {
+  /**
+   * Offloaded version of generateGMCR using SYCL kernels.
+   * Every (query graph, data graph) pair is checked once: the qualifying pairs are flagged in a per data graph bitmap,
+   * the per data graph counts are scanned on the device and the flags are compacted in query graph order.
+   * The flags are submitted after depends (e.g. the last filter stage), the host only waits for the pair count that sizes the indices.
+   */
+  utils::BatchedEvent generateGMCR(sigmo::DeviceBatchedCSRGraph& query_graphs,
+                                   sigmo::DeviceBatchedCSRGraph& data_graphs,
+                                   sigmo::candidates::Candidates& candidates,
+                                   const std::vector<sycl::event>& depends = {}) {
     // Get dimensions
     const size_t total_query_graphs = query_graphs.num_graphs;
     const size_t total_data_graphs = data_graphs.num_graphs;
+    const size_t flag_bits = sizeof(uint32_t) * 8;
+    const size_t flag_words = (total_query_graphs + flag_bits - 1) / flag_bits;
 
-    // Allocate device memory for data_graph_offsets (size = total_data_graphs+1)
+    // Allocate device memory for data_graph_offsets (size = total_data_graphs+1) and the pair flags
     uint32_t* d_data_graph_offsets = device::memory::malloc<uint32_t>(total_data_graphs + 1, queue);
-    // Initialize to zero
-    queue.fill(d_data_graph_offsets, 0, total_data_graphs + 1).wait();
-
-    // --- Kernel 1: Count query graphs (with > 1 node) per data graph ---
-    // For each pair (query_graph, data_graph), if every node in the query graph
-    // has a candidate in the given data graph, then atomically increment the counter.
+    uint32_t* d_pair_flags = device::memory::malloc<uint32_t>(total_data_graphs * flag_words, queue);
+    auto k0 = queue.fill(d_data_graph_offsets, 0, total_data_graphs + 1);
+    std::vector<sycl::event> k1_depends{depends};
+    k1_depends.push_back(k0);
+    k1_depends.push_back(candidates.buildSummary(data_graphs, depends));
+
+    // --- Kernel 1: Flag the qualifying pairs and count them per data graph ---
+    // A pair qualifies if the query graph has more than one node and every node has a candidate in the data graph,
+    // which reduces to an AND of the candidates summary bits of its query nodes.
+    // Each work-item checks 32 query graphs against one data graph and writes their flags as a single word.
     auto k1 = queue.parallel_for(
-        sycl::range<2>(total_query_graphs, total_data_graphs),
+        sycl::range<2>(total_data_graphs, flag_words),
+        k1_depends,
         [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice()](sycl::id<2> idx) {
-          size_t query_graph_id = idx[0];
-          size_t data_graph_id = idx[1];
+          size_t data_graph_id = idx[0];
+          size_t word_id = idx[1];
           size_t start_data = data_graphs.graph_offsets[data_graph_id];
           size_t end_data = data_graphs.graph_offsets[data_graph_id + 1];
-          size_t num_query_nodes = query_graphs.getGraphNodes(query_graph_id);
 
-          size_t offset_query_nodes = query_graphs.getPreviousNodes(query_graph_id);
-          bool add = true;
-          for (size_t i = 0; i < num_query_nodes && add; i++) {
-            size_t global_query_node = offset_query_nodes + i;
-            add = add && (candidates.getCandidatesCount(global_query_node, start_data, end_data) > 0);
+          uint32_t flags = 0;
+          for (size_t bit = 0; bit < flag_bits; bit++) {
+            size_t query_graph_id = word_id * flag_bits + bit;
+            if (query_graph_id >= total_query_graphs) break;
+            size_t num_query_nodes = query_graphs.getGraphNodes(query_graph_id);
+            if (num_query_nodes <= 1) continue; // skip
+            size_t offset_query_nodes = query_graphs.getPreviousNodes(query_graph_id);
+            if (candidates.hasCandidates(offset_query_nodes, num_query_nodes, data_graph_id, start_data, end_data)) {
+              flags |= static_cast<uint32_t>(1) << bit;
+            }
           }
-          if (add) {
-            // Increment the counter for this data graph.
+          d_pair_flags[data_graph_id * flag_words + word_id] = flags;
+          if (flags != 0) {
             sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device> atomic_offset(
                 d_data_graph_offsets[data_graph_id + 1]);
-            atomic_offset.fetch_add(1);
+            atomic_offset.fetch_add(sycl::popcount(flags));
           }
         });
-    k1.wait();
 
     // --- Kernel 2: Compute prefix sum of data_graph_offsets ---
-    // (Here we assume total_data_graphs is small so a single task is acceptable.)
-    auto k2 = queue.single_task([=]() {
-      for (size_t i = 1; i <= total_data_graphs; i++) { d_data_graph_offsets[i] += d_data_graph_offsets[i - 1]; }
-    });
-    k2.wait();
+    auto k2 = device::inclusiveScan(queue, d_data_graph_offsets + 1, total_data_graphs, k1);
 
     // The total number of query indices is now the last element in d_data_graph_offsets.
     uint32_t total_query_indices;
-    queue.copy(&d_data_graph_offsets[total_data_graphs], &total_query_indices, 1).wait();
+    queue.copy(&d_data_graph_offsets[total_data_graphs], &total_query_indices, 1, k2).wait();
     gmcr.total_query_indices = total_query_indices;
 
     // Allocate device memory for query_graph_indices.
     uint32_t* d_query_graph_indices = device::memory::malloc<uint32_t>(total_query_indices, queue);
 
-    // Create a copy of the prefix sum array to serve as atomic “current offsets”
-    uint32_t* current_offsets = device::memory::malloc<uint32_t>(total_data_graphs + 1, queue);
-    queue.copy(d_data_graph_offsets, current_offsets, total_data_graphs + 1).wait();
-
     // --- Kernel 3: Fill query_graph_indices ---
-    // For each (query_graph, data_graph) pair (with query graphs having > 1 node),
-    // if the graph qualifies (each query node has a candidate in the data graph),
-    // then atomically obtain an index (from current_offsets) and write the query_graph_id.
-    auto k3 = queue.parallel_for(
-        sycl::range<2>(total_query_graphs, total_data_graphs),
-        [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice()](sycl::id<2> idx) {
-          size_t query_graph_id = idx[0];
-          size_t data_graph_id = idx[1];
-          size_t num_query_nodes = query_graphs.getGraphNodes(query_graph_id);
-          if (num_query_nodes <= 1) return; // skip
-          size_t offset_query_nodes = query_graphs.getPreviousNodes(query_graph_id);
-          bool add = true;
-          for (size_t i = 0; i < num_query_nodes && add; i++) {
-            size_t global_query_node = offset_query_nodes + i;
-            size_t start_data = data_graphs.graph_offsets[data_graph_id];
-            size_t end_data = data_graphs.graph_offsets[data_graph_id + 1];
-            add = add && (candidates.getCandidatesCount(global_query_node, start_data, end_data) > 0);
-          }
-          if (add) {
-            sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> atomic_off(
-                current_offsets[data_graph_id]);
-            uint32_t index = atomic_off.fetch_add(1);
-            d_query_graph_indices[index] = static_cast<uint32_t>(query_graph_id);
-          }
-        });
+    // Every flag word knows its position from the data graph offset and the flags of the previous words, no atomics needed.
+    auto k3 = queue.parallel_for(sycl::range<2>(total_data_graphs, flag_words), k2, [=](sycl::id<2> idx) {
+      size_t data_graph_id = idx[0];
+      size_t word_id = idx[1];
+      const uint32_t* row = d_pair_flags + data_graph_id * flag_words;
+      uint32_t flags = row[word_id];
+      if (flags == 0) return;
+      uint32_t index = d_data_graph_offsets[data_graph_id];
+      for (size_t w = 0; w < word_id; w++) { index += sycl::popcount(row[w]); }
+      for (; flags != 0; flags &= flags - 1) { d_query_graph_indices[index++] = static_cast<uint32_t>(word_id * flag_bits + sycl::ctz(flags)); }
+    });
     k3.wait();
 
     // Build the result structure.
     gmcr.data_graph_offsets = d_data_graph_offsets;
     gmcr.query_graph_indices = d_query_graph_indices;
-    sycl::free(current_offsets, queue);
+    sycl::free(d_pair_flags, queue);
 
     utils::BatchedEvent ret;
     ret.add(k1);
@@ -127,6 +122,25 @@ public:
     return ret;
   }
 
+  /**
+   * Build the GMCR from already compacted candidates: the surviving pairs are the GMCR entries, in the same order.
+   */
+  utils::BatchedEvent
+  generateGMCR(sigmo::DeviceBatchedCSRGraph& query_graphs, sigmo::DeviceBatchedCSRGraph& data_graphs, sigmo::candidates::PairCandidates& candidates) {
+    const size_t total_data_graphs = data_graphs.num_graphs;
+    auto pairs = candidates.getCandidatesDevice();
+
+    gmcr.total_query_indices = pairs.num_pairs;
+    gmcr.data_graph_offsets = device::memory::malloc<uint32_t>(total_data_graphs + 1, queue);
+    gmcr.query_graph_indices = device::memory::malloc<uint32_t>(pairs.num_pairs, queue);
+
+    utils::BatchedEvent ret;
+    ret.add(queue.copy(pairs.data_graph_pairs, gmcr.data_graph_offsets, total_data_graphs + 1));
+    ret.add(queue.copy(pairs.pair_query_graphs, gmcr.query_graph_indices, pairs.num_pairs));
+    ret.wait();
+    return ret;
+  }
+
   GMCRDevice getGMCRDevice() { return gmcr; }
 };
 
@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2025 University of Salerno
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "engine.hpp"
+#include "graph.hpp"
+#include "io.hpp"
+#include "signature.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace sigmo {
+namespace host {
+
+/**
+ * Run fn(worker, begin, end) over [0, size) on num_threads threads. The threads claim chunks of grain items from a
+ * shared counter, so a thread done with cheap molecules keeps taking work off the ones stuck on expensive ones.
+ */
+template<typename F>
+void parallelFor(size_t size, size_t num_threads, size_t grain, F&& fn) {
+  std::atomic<size_t> next{0};
+  auto worker = [&](size_t worker_id) {
+    for (size_t begin = next.fetch_add(grain); begin < size; begin = next.fetch_add(grain)) { fn(worker_id, begin, std::min(size, begin + grain)); }
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < num_threads; ++t) { threads.emplace_back(worker, t); }
+  worker(0);
+  for (auto& thread : threads) { thread.join(); }
+}
+
+/**
+ * A batch of graphs in host memory: every node keeps the adjacency row of its graph as a bitmap of words(graph) words,
+ * and its signature at every refinement level.
+ */
+struct HostBatch {
+  using SignatureT = signature::Signature<>::SignatureDevice;
+
+  std::vector<uint32_t> graph_offsets{0}; // nodes of graph g are [graph_offsets[g], graph_offsets[g + 1])
+  std::vector<size_t> row_offsets{0};     // adjacency words of graph g start at row_offsets[g]
+  std::vector<types::label_t> labels;
+  std::vector<uint64_t> adjacency;
+  std::vector<std::vector<SignatureT>> signatures; // [level - 1][node], for levels 1..refinement_steps
+
+  size_t getNumGraphs() const { return graph_offsets.size() - 1; }
+  size_t getNumNodes() const { return labels.size(); }
+  uint32_t getGraphNodes(size_t g) const { return graph_offsets[g + 1] - graph_offsets[g]; }
+  static size_t getWords(uint32_t nodes) { return (nodes + 63) / 64; }
+
+  const uint64_t* getRow(size_t g, uint32_t local_node) const { return adjacency.data() + row_offsets[g] + local_node * getWords(getGraphNodes(g)); }
+
+  explicit HostBatch(const std::vector<CSRGraph>& graphs) {
+    for (auto& graph : graphs) {
+      const uint32_t nodes = graph.getNumNodes();
+      const size_t words = getWords(nodes);
+      const size_t row_start = adjacency.size();
+      adjacency.resize(row_start + nodes * words, 0);
+      for (uint32_t u = 0; u < nodes; ++u) {
+        for (auto e = graph.getRowOffsets()[u]; e < graph.getRowOffsets()[u + 1]; ++e) {
+          const auto v = graph.getColumnIndices()[e];
+          adjacency[row_start + u * words + v / 64] |= uint64_t{1} << (v % 64);
+        }
+      }
+      labels.insert(labels.end(), graph.getNodeLabels(), graph.getNodeLabels() + nodes);
+      graph_offsets.push_back(graph_offsets.back() + nodes);
+      row_offsets.push_back(adjacency.size());
+    }
+  }
+
+  /**
+   * Signatures of the PowerGraph refinement: at level l a node counts the labels of the nodes at distance exactly l,
+   * the same counts the device kernels build step by step.
+   */
+  void generateSignatures(size_t refinement_steps, size_t num_threads) {
+    signatures.assign(refinement_steps, std::vector<SignatureT>(getNumNodes()));
+    if (refinement_steps == 0) { return; }
+    parallelFor(getNumGraphs(), num_threads, 64, [&](size_t, size_t begin, size_t end) {
+      std::vector<uint64_t> reached, frontier, next;
+      for (size_t g = begin; g < end; ++g) {
+        const uint32_t nodes = getGraphNodes(g);
+        const size_t words = getWords(nodes);
+        for (uint32_t u = 0; u < nodes; ++u) {
+          reached.assign(words, 0);
+          frontier.assign(words, 0);
+          reached[u / 64] = frontier[u / 64] = uint64_t{1} << (u % 64);
+          for (size_t level = 1; level <= refinement_steps; ++level) {
+            next.assign(words, 0);
+            forEachBit(frontier.data(), words, [&](uint32_t v) {
+              const uint64_t* row = getRow(g, v);
+              for (size_t w = 0; w < words; ++w) { next[w] |= row[w] & ~reached[w]; }
+            });
+            auto& signature = signatures[level - 1][graph_offsets[g] + u];
+            forEachBit(next.data(), words, [&](uint32_t v) { signature.incrementLabelCount(labels[graph_offsets[g] + v]); });
+            for (size_t w = 0; w < words; ++w) { reached[w] |= next[w]; }
+            frontier.swap(next);
+          }
+        }
+      }
+    });
+  }
+
+  template<typename F>
+  static void forEachBit(const uint64_t* words, size_t num_words, F&& fn) {
+    for (size_t w = 0; w < num_words; ++w) {
+      for (uint64_t word = words[w]; word != 0; word &= word - 1) { fn(static_cast<uint32_t>(w * 64 + std::countr_zero(word))); }
+    }
+  }
+};
+
+/**
+ * The SIGMo pipeline on the host threads, for nodes without a GPU: same inputs, filter and match counts as Engine.
+ * Every thread takes whole data graphs, filters all the query graphs against one molecule at a time into a small
+ * candidate bitmap that stays in cache, and enumerates the embeddings with a bitmask DFS.
+ */
+class HostEngine {
+public:
+  explicit HostEngine(EngineConfig config = {}, size_t num_threads = 0)
+      : config(std::move(config)), num_threads(num_threads > 0 ? num_threads : std::max(1u, std::thread::hardware_concurrency())) {}
+
+  void loadData(const std::vector<CSRGraph>& data_graphs) {
+    auto start = std::chrono::steady_clock::now();
+    data.emplace(data_graphs);
+    data->generateSignatures(config.refinement_steps, num_threads);
+    data_signature_time = std::chrono::steady_clock::now() - start;
+  }
+
+  QueryResult runQueries(const std::vector<CSRGraph>& query_graphs) {
+    if (!data) { throw std::runtime_error("HostEngine::runQueries called before loadData"); }
+    QueryResult result;
+    result.query_graphs = query_graphs.size();
+    auto start = std::chrono::steady_clock::now();
+    HostBatch queries{query_graphs};
+    queries.generateSignatures(config.refinement_steps, num_threads);
+    auto filter_start = std::chrono::steady_clock::now();
+    result.query_signature_time = filter_start - start;
+
+    std::vector<WorkerCounts> counts(num_threads);
+    parallelFor(data->getNumGraphs(), num_threads, 16, [&](size_t worker, size_t begin, size_t end) {
+      Scratch scratch;
+      for (size_t g = begin; g < end; ++g) { matchDataGraph(queries, g, scratch, counts[worker]); }
+    });
+    for (auto& count : counts) {
+      result.pairs += count.pairs;
+      result.matches += count.matches;
+    }
+    // the filter and the join are fused per molecule, their time is reported as join time
+    result.join_time = std::chrono::steady_clock::now() - filter_start;
+    return result;
+  }
+
+  size_t getNumThreads() const { return num_threads; }
+  size_t getNumDataGraphs() const { return data ? data->getNumGraphs() : 0; }
+  size_t getNumDataNodes() const { return data ? data->getNumNodes() : 0; }
+  std::chrono::duration<double> getDataSignatureTime() const { return data_signature_time; }
+
+private:
+  struct alignas(64) WorkerCounts {
+    size_t pairs = 0;
+    size_t matches = 0;
+  };
+
+  struct Scratch {
+    std::vector<uint64_t> label_nodes; // nodes of the data graph by label
+    std::vector<uint64_t> candidates;  // candidates of every query node, in the query node order
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> position;
+    std::vector<uint64_t> available; // nodes left at every depth
+    std::vector<uint32_t> mapping;
+    std::vector<uint64_t> used;
+  };
+
+  EngineConfig config;
+  size_t num_threads;
+  std::optional<HostBatch> data;
+  std::chrono::duration<double> data_signature_time{0};
+
+  void matchDataGraph(const HostBatch& queries, size_t g, Scratch& scratch, WorkerCounts& counts) const {
+    const uint32_t data_nodes = data->getGraphNodes(g);
+    const size_t words = HostBatch::getWords(data_nodes);
+    const uint32_t data_offset = data->graph_offsets[g];
+    scratch.label_nodes.assign(256 * words, 0);
+    for (uint32_t v = 0; v < data_nodes; ++v) { scratch.label_nodes[data->labels[data_offset + v] * words + v / 64] |= uint64_t{1} << (v % 64); }
+    std::vector<uint64_t> all_nodes(words, ~uint64_t{0});
+    if (data_nodes % 64 != 0) { all_nodes.back() = (uint64_t{1} << (data_nodes % 64)) - 1; }
+
+    for (size_t q = 0; q < queries.getNumGraphs(); ++q) {
+      const uint32_t query_nodes = queries.getGraphNodes(q);
+      if (query_nodes <= 1) { continue; }
+      if (!filterPair(queries, q, g, all_nodes, scratch)) { continue; }
+      counts.pairs++;
+      if (config.skip_join) { continue; }
+      const size_t matches = countEmbeddings(queries, q, g, scratch);
+      counts.matches += config.find_all ? matches : std::min<size_t>(matches, 1);
+    }
+  }
+
+  /**
+   * Candidates of the query nodes in the data graph: same label (or a wildcard) and dominating signatures at every
+   * refinement level. False when a query node is left without candidates, i.e. the pair is not in the GMCR.
+   */
+  bool filterPair(const HostBatch& queries, size_t q, size_t g, const std::vector<uint64_t>& all_nodes, Scratch& scratch) const {
+    const uint32_t query_nodes = queries.getGraphNodes(q);
+    const uint32_t query_offset = queries.graph_offsets[q];
+    const uint32_t data_offset = data->graph_offsets[g];
+    const size_t words = all_nodes.size();
+    scratch.candidates.resize(query_nodes * words);
+    for (uint32_t u = 0; u < query_nodes; ++u) {
+      const auto label = queries.labels[query_offset + u];
+      const uint64_t* source = label == types::WILDCARD_NODE ? all_nodes.data() : scratch.label_nodes.data() + label * words;
+      uint64_t* row = scratch.candidates.data() + u * words;
+      bool empty = true;
+      for (size_t w = 0; w < words; ++w) {
+        uint64_t word = source[w];
+        for (uint64_t bits = word; bits != 0; bits &= bits - 1) {
+          const uint32_t v = static_cast<uint32_t>(w * 64 + std::countr_zero(bits));
+          for (size_t level = 0; level < data->signatures.size(); ++level) {
+            if (!data->signatures[level][data_offset + v].dominates(queries.signatures[level][query_offset + u])) {
+              word &= ~(uint64_t{1} << (v % 64));
+              break;
+            }
+          }
+        }
+        row[w] = word;
+        empty &= word == 0;
+      }
+      if (empty) { return false; }
+    }
+    return true;
+  }
+
+  /**
+   * Induced embeddings of query graph q into data graph g, as counted by the device join. The query nodes are matched
+   * most constrained first: the fewest candidates, then the most neighbors already matched.
+   */
+  size_t countEmbeddings(const HostBatch& queries, size_t q, size_t g, Scratch& scratch) const {
+    const uint32_t n = queries.getGraphNodes(q);
+    const size_t words = HostBatch::getWords(data->getGraphNodes(g));
+    auto count_candidates = [&](uint32_t u) {
+      size_t count = 0;
+      for (size_t w = 0; w < words; ++w) { count += std::popcount(scratch.candidates[u * words + w]); }
+      return count;
+    };
+    auto query_adjacent = [&](uint32_t u, uint32_t v) { return (queries.getRow(q, u)[v / 64] >> (v % 64)) & 1; };
+
+    // matching order
+    scratch.order.clear();
+    scratch.position.assign(n, UINT32_MAX);
+    std::vector<size_t> sizes(n);
+    for (uint32_t u = 0; u < n; ++u) { sizes[u] = count_candidates(u); }
+    while (scratch.order.size() < n) {
+      uint32_t best = UINT32_MAX, best_links = 0;
+      for (uint32_t u = 0; u < n; ++u) {
+        if (scratch.position[u] != UINT32_MAX) { continue; }
+        uint32_t links = 0;
+        for (auto v : scratch.order) { links += query_adjacent(u, v); }
+        if (best == UINT32_MAX || links > best_links || (links == best_links && sizes[u] < sizes[best])) {
+          best = u;
+          best_links = links;
+        }
+      }
+      scratch.position[best] = scratch.order.size();
+      scratch.order.push_back(best);
+    }
+
+    // iterative DFS over bitmasks: available[depth] holds the data nodes left for the query node at that depth
+    scratch.available.assign(n * words, 0);
+    scratch.mapping.assign(n, 0);
+    scratch.used.assign(words, 0);
+    auto expand = [&](uint32_t depth) {
+      const uint32_t u = scratch.order[depth];
+      uint64_t* available = scratch.available.data() + depth * words;
+      for (size_t w = 0; w < words; ++w) { available[w] = scratch.candidates[u * words + w] & ~scratch.used[w]; }
+      for (uint32_t i = 0; i < depth; ++i) {
+        const uint64_t* row = data->getRow(g, scratch.mapping[i]);
+        const bool adjacent = query_adjacent(u, scratch.order[i]);
+        for (size_t w = 0; w < words; ++w) { available[w] &= adjacent ? row[w] : ~row[w]; }
+      }
+    };
+
+    size_t matches = 0;
+    int64_t depth = 0;
+    expand(0);
+    while (depth >= 0) {
+      uint64_t* available = scratch.available.data() + depth * words;
+      size_t w = 0;
+      while (w < words && available[w] == 0) { w++; }
+      if (w == words) { // exhausted, backtrack
+        if (--depth >= 0) { scratch.used[scratch.mapping[depth] / 64] &= ~(uint64_t{1} << (scratch.mapping[depth] % 64)); }
+        continue;
+      }
+      const uint32_t v = static_cast<uint32_t>(w * 64 + std::countr_zero(available[w]));
+      available[w] &= available[w] - 1;
+      if (depth + 1 == n) {
+        matches++;
+        if (!config.find_all) { return matches; }
+        continue;
+      }
+      scratch.mapping[depth] = v;
+      scratch.used[v / 64] |= uint64_t{1} << (v % 64);
+      expand(++depth);
+    }
+    return matches;
+  }
+};
+
+/**
+ * The pairs the device kernels cannot take: every query graph against the oversized data graphs, and the oversized
+ * query graphs against the device-sized data graphs. The device-sized data graphs are only indexed on the host the
+ * first time a batch brings an oversized query.
+ */
+class FallbackEngine {
+public:
+  explicit FallbackEngine(EngineConfig config = {}, size_t num_threads = 0)
+      : oversized_data(config, num_threads), device_data(config, num_threads) {}
+
+  void loadData(std::vector<CSRGraph> device_sized_graphs, const std::vector<CSRGraph>& oversized_graphs) {
+    oversized_data.loadData(oversized_graphs);
+    num_device_data_graphs = device_sized_graphs.size();
+    num_oversized_data_graphs = oversized_graphs.size();
+    pending_data = std::move(device_sized_graphs);
+    device_data_loaded = false;
+  }
+
+  QueryResult runQueries(const io::SizedGraphs& query_graphs) {
+    auto start = std::chrono::steady_clock::now();
+    QueryResult result;
+    if (num_oversized_data_graphs > 0) {
+      std::vector<CSRGraph> all_queries{query_graphs.device};
+      all_queries.insert(all_queries.end(), query_graphs.oversized.begin(), query_graphs.oversized.end());
+      merge(result, oversized_data.runQueries(all_queries));
+    }
+    if (!query_graphs.oversized.empty() && num_device_data_graphs > 0) {
+      if (!device_data_loaded) {
+        device_data.loadData(pending_data);
+        pending_data.clear();
+        device_data_loaded = true;
+      }
+      merge(result, device_data.runQueries(query_graphs.oversized));
+    }
+    result.query_graphs = query_graphs.device.size() + query_graphs.oversized.size();
+    result.host_time = std::chrono::steady_clock::now() - start;
+    return result;
+  }
+
+  bool isNeeded(const io::SizedGraphs& query_graphs) const { return num_oversized_data_graphs > 0 || !query_graphs.oversized.empty(); }
+  size_t getNumOversizedDataGraphs() const { return num_oversized_data_graphs; }
+
+private:
+  HostEngine oversized_data; // all the query graphs
+  HostEngine device_data;    // the oversized query graphs
+  std::vector<CSRGraph> pending_data;
+  bool device_data_loaded = false;
+  size_t num_device_data_graphs = 0;
+  size_t num_oversized_data_graphs = 0;
+
+  static void merge(QueryResult& result, const QueryResult& part) {
+    result.matches += part.matches;
+    result.pairs += part.pairs;
+  }
+};
+
+} // namespace host
+
+/**
+ * Engine for data and query graphs of any size: the graphs within the device limits go through the device pipeline,
+ * the pairs involving an oversized graph through a FallbackEngine running concurrently on the host threads.
+ */
+class HybridEngine {
+public:
+  HybridEngine(sycl::queue& queue, EngineConfig config = {}, size_t num_threads = 0)
+      : queue(queue), engine(std::make_unique<Engine>(queue, config)), fallback(config, num_threads), config(std::move(config)) {}
+
+  void loadData(std::vector<CSRGraph>& data_graphs) {
+    auto sized = io::splitBySize(std::vector<CSRGraph>{data_graphs}, types::MAX_DEVICE_DATA_NODES);
+    num_data_graphs = data_graphs.size();
+    num_data_nodes = 0;
+    for (auto& graph : data_graphs) { num_data_nodes += graph.getNumNodes(); }
+    if (sized.device.empty()) {
+      engine = std::make_unique<Engine>(queue, config); // drop the data graphs of a previous load
+    } else {
+      engine->loadData(sized.device);
+    }
+    fallback.loadData(std::move(sized.device), sized.oversized);
+    loaded = true;
+  }
+
+  QueryResult runQueries(std::vector<CSRGraph>& query_graphs) {
+    if (!loaded) { throw std::runtime_error("HybridEngine::runQueries called before loadData"); }
+    auto sized = io::splitBySize(std::vector<CSRGraph>{query_graphs}, types::MAX_DEVICE_QUERY_NODES);
+    std::future<QueryResult> host_result;
+    if (fallback.isNeeded(sized)) { host_result = std::async(std::launch::async, [&]() { return fallback.runQueries(sized); }); }
+
+    QueryResult result;
+    if (engine->isLoaded() && !sized.device.empty()) { result = engine->runQueries(sized.device); }
+    if (host_result.valid()) {
+      auto host = host_result.get();
+      result.matches += host.matches;
+      result.pairs += host.pairs;
+      result.host_time = host.host_time;
+    }
+    result.query_graphs = query_graphs.size();
+    return result;
+  }
+
+  bool isLoaded() const { return loaded; }
+  size_t getNumDataGraphs() const { return num_data_graphs; }
+  size_t getNumDataNodes() const { return num_data_nodes; }
+  size_t getNumOversizedDataGraphs() const { return fallback.getNumOversizedDataGraphs(); }
+  std::chrono::duration<double> getDataSignatureTime() const { return engine->getDataSignatureTime(); }
+  const EngineConfig& getConfig() const { return config; }
+
+private:
+  sycl::queue& queue;
+  std::unique_ptr<Engine> engine; // the device-sized graphs
+  host::FallbackEngine fallback;
+  EngineConfig config;
+  bool loaded = false;
+  size_t num_data_graphs = 0;
+  size_t num_data_nodes = 0;
+};
+
+} // namespace sigmo
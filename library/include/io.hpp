@@ -7,9 +7,15 @@
 
 #include "graph.hpp"
 #include "pool.hpp"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 namespace sigmo {
 namespace io {
@@ -54,6 +60,100 @@ std::vector<CSRGraph> loadCSRGraphsFromFile(const std::string& filename) {
   return data_graphs;
 }
 
+/**
+ * Graphs classified by size: the ones the device kernels take, and the oversized ones routed to the host.
+ * Both keep the relative order of the input.
+ */
+struct SizedGraphs {
+  std::vector<CSRGraph> device;
+  std::vector<CSRGraph> oversized;
+};
+
+SizedGraphs splitBySize(std::vector<CSRGraph>&& graphs, size_t max_device_nodes) {
+  SizedGraphs sized;
+  for (auto& graph : graphs) {
+    (graph.getNumNodes() > max_device_nodes ? sized.oversized : sized.device).push_back(std::move(graph));
+  }
+  graphs.clear();
+  return sized;
+}
+
+SizedGraphs loadSizedCSRGraphsFromFile(const std::string& filename, size_t max_device_nodes) {
+  return splitBySize(loadCSRGraphsFromFile(filename), max_device_nodes);
+}
+
+/**
+ * Byte offsets of the lines of a text file: line i spans [offsets[i], offsets[i + 1]), its newline included.
+ * The index is kept in a binary sidecar next to the file (magic, file size, line count, offsets) so that readers can
+ * split the file into exact line ranges without scanning it. A sidecar whose file size does not match is stale.
+ */
+struct LineIndex {
+  static constexpr char MAGIC[8] = {'S', 'I', 'G', 'M', 'O', 'I', 'D', 'X'};
+
+  uint64_t file_size = 0;
+  std::vector<uint64_t> offsets{0};
+
+  size_t getNumLines() const { return offsets.size() - 1; }
+  static std::string getSidecarPath(const std::string& filename) { return filename + ".idx"; }
+
+  static LineIndex build(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) { throw std::runtime_error("Cannot open " + filename); }
+    LineIndex index;
+    std::vector<char> block(1 << 20);
+    uint64_t position = 0;
+    while (file) {
+      file.read(block.data(), block.size());
+      const auto count = file.gcount();
+      for (std::streamsize i = 0; i < count; ++i) {
+        if (block[i] == '\n') { index.offsets.push_back(position + i + 1); }
+      }
+      position += count;
+    }
+    index.file_size = position;
+    if (index.offsets.back() != position) { index.offsets.push_back(position); } // last line without a newline
+    return index;
+  }
+
+  static std::optional<LineIndex> read(const std::string& filename) {
+    std::ifstream sidecar(getSidecarPath(filename), std::ios::binary);
+    if (!sidecar) { return std::nullopt; }
+    char magic[sizeof(MAGIC)];
+    LineIndex index;
+    uint64_t num_lines = 0;
+    sidecar.read(magic, sizeof(magic));
+    sidecar.read(reinterpret_cast<char*>(&index.file_size), sizeof(index.file_size));
+    sidecar.read(reinterpret_cast<char*>(&num_lines), sizeof(num_lines));
+    if (!sidecar || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) { return std::nullopt; }
+    std::error_code error;
+    if (std::filesystem::file_size(filename, error) != index.file_size || error) { return std::nullopt; }
+    index.offsets.resize(num_lines + 1);
+    sidecar.read(reinterpret_cast<char*>(index.offsets.data()), index.offsets.size() * sizeof(uint64_t));
+    if (!sidecar || index.offsets.back() != index.file_size) { return std::nullopt; }
+    return index;
+  }
+
+  bool write(const std::string& filename) const {
+    std::ofstream sidecar(getSidecarPath(filename), std::ios::binary | std::ios::trunc);
+    if (!sidecar) { return false; }
+    const uint64_t num_lines = getNumLines();
+    sidecar.write(MAGIC, sizeof(MAGIC));
+    sidecar.write(reinterpret_cast<const char*>(&file_size), sizeof(file_size));
+    sidecar.write(reinterpret_cast<const char*>(&num_lines), sizeof(num_lines));
+    sidecar.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    return static_cast<bool>(sidecar);
+  }
+
+  /**
+   * The sidecar index of the file, built and written on the first read. A read-only location only costs the scan.
+   */
+  static LineIndex loadOrBuild(const std::string& filename) {
+    if (auto index = read(filename)) { return *index; }
+    auto index = build(filename);
+    index.write(filename);
+    return index;
+  }
+};
 
 } // namespace io
 } // namespace sigmo
\ No newline at end of file
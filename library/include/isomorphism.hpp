@@ -10,9 +10,15 @@
 #include "graph.hpp"
 #include "pool.hpp"
 #include "signature.hpp"
+#include "trie.hpp"
 #include "types.hpp"
 #include "utils.hpp"
+#include <algorithm>
+#include <bit>
+#include <numeric>
 #include <sycl/sycl.hpp>
+#include <tuple>
+#include <utility>
 
 
 namespace sigmo {
@@ -24,33 +30,62 @@ utils::BatchedEvent filterCandidates(sycl::queue& queue,
                                      sigmo::DeviceBatchedCSRGraph& query_graph,
                                      sigmo::DeviceBatchedCSRGraph& data_graph,
                                      sigmo::signature::Signature<>& signatures,
-                                     sigmo::candidates::Candidates& candidates) {
+                                     sigmo::candidates::Candidates& candidates,
+                                     const std::vector<sycl::event>& depends = {}) {
   size_t total_query_nodes = query_graph.total_nodes;
   size_t total_data_nodes = data_graph.total_nodes;
+  // with the aligned layout the kernel walks bit positions, padding included
+  size_t total_positions = D == CandidatesDomain::Query ? candidates.getCandidatesDevice().target_nodes : total_data_nodes;
 
   sycl::range<1> local_range{device::deviceOptions.filter_work_group_size};
-  sycl::range<1> global_range{((total_data_nodes + local_range[0] - 1) / local_range[0]) * local_range[0]};
+  sycl::range<1> global_range{((total_positions + local_range[0] - 1) / local_range[0]) * local_range[0]};
+  // candidate words never straddle two work-groups, so a sub-group spanning whole words owns them
+  const bool aligned_groups = local_range[0] % candidates.getCandidatesDevice().num_bits == 0;
 
   auto e = queue.submit([&](sycl::handler& cgh) {
+    cgh.depends_on(depends);
     cgh.parallel_for<sigmo::device::kernels::FilterCandidatesKernel<D>>(
         sycl::nd_range<1>({global_range, local_range}),
-        [=,
-         candidates = candidates.getCandidatesDevice(),
-         query_signatures = signatures.getDeviceQuerySignatures(),
-         data_signatures = signatures.getDeviceDataSignatures(),
-         max_labels = signatures.getMaxLabels()](sycl::nd_item<1> item) {
-          auto data_node_id = item.get_global_id(0);
-          if (data_node_id >= total_data_nodes) { return; }
-          auto data_signature = data_signatures[data_node_id];
+        [=, candidates = candidates.getCandidatesDevice()](sycl::nd_item<1> item) {
+          auto position = item.get_global_id(0);
+          auto data_node_id = position < total_positions ? candidates.getNodeAt(position) : types::NULL_NODE;
           auto query_labels = query_graph.node_labels;
           auto data_labels = data_graph.node_labels;
 
-          for (size_t query_node_id = 0; query_node_id < total_query_nodes; ++query_node_id) {
-            if (query_labels[query_node_id] != data_labels[data_node_id] && query_labels[query_node_id] != types::WILDCARD_NODE) { continue; }
-            if constexpr (D == CandidatesDomain::Data) {
+          if constexpr (D == CandidatesDomain::Data) {
+            if (data_node_id == types::NULL_NODE) { return; }
+            for (size_t query_node_id = 0; query_node_id < total_query_nodes; ++query_node_id) {
+              if (query_labels[query_node_id] != data_labels[data_node_id] && query_labels[query_node_id] != types::WILDCARD_NODE) { continue; }
               candidates.insert(data_node_id, query_node_id);
-            } else {
-              candidates.atomicInsert(query_node_id, data_node_id);
+            }
+          } else {
+            // the sub-group builds the candidate words of its positions with a ballot, so every word is written once:
+            // with a plain store when the sub-group spans whole words, with atomic ORs otherwise, the ballot bits of a
+            // writer lane not starting on a word boundary straddle its word and the next one
+            const auto sg = item.get_sub_group();
+            const uint32_t lane = sg.get_local_linear_id();
+            const bool full_words = aligned_groups && sg.get_local_linear_range() >= candidates.num_bits;
+            const bool writer = lane % candidates.num_bits == 0 && position < total_positions;
+            const size_t word_id = position / candidates.num_bits;
+            const uint32_t shift = position % candidates.num_bits;
+            const auto data_label = data_node_id != types::NULL_NODE ? data_labels[data_node_id] : types::WILDCARD_NODE;
+
+            for (size_t query_node_id = 0; query_node_id < total_query_nodes; ++query_node_id) {
+              bool hit = data_node_id != types::NULL_NODE
+                         && (query_labels[query_node_id] == data_label || query_labels[query_node_id] == types::WILDCARD_NODE);
+              auto mask = sycl::ext::oneapi::group_ballot(sg, hit);
+              if (!writer) { continue; }
+              types::candidates_t word = 0;
+              mask.extract_bits(word, lane);
+              if (word == 0) { continue; } // the bitmap is zeroed on allocation
+              if (full_words) {
+                candidates.setWord(query_node_id, word_id, word);
+              } else {
+                candidates.atomicInsertWord(query_node_id, word_id, word << shift);
+                if (shift != 0 && (word >> (candidates.num_bits - shift)) != 0) {
+                  candidates.atomicInsertWord(query_node_id, word_id + 1, word >> (candidates.num_bits - shift));
+                }
+              }
             }
           }
         });
@@ -58,64 +93,83 @@ utils::BatchedEvent filterCandidates(sycl::queue& queue,
 
   utils::BatchedEvent be;
   be.add(e);
+  candidates.invalidateSummary();
   return be;
 }
 
-template<CandidatesDomain D = CandidatesDomain::Query>
-utils::BatchedEvent refineCandidates(sycl::queue& queue,
-                                     sigmo::DeviceBatchedCSRGraph& query_graph,
-                                     sigmo::DeviceBatchedCSRGraph& data_graph,
-                                     sigmo::signature::Signature<>& signatures,
-                                     sigmo::candidates::Candidates& candidates) {
-  size_t total_query_nodes = query_graph.total_nodes;
-  size_t total_data_nodes = data_graph.total_nodes;
-
-  sycl::range<1> local_range{device::deviceOptions.filter_work_group_size};
-  sycl::range<1> global_range{((total_data_nodes + local_range[0] - 1) / local_range[0]) * local_range[0]};
-
-  size_t integers_per_wg = local_range[0] / candidates.getCandidatesDevice().num_bits;
+/**
+ * Query-domain refinement over 2D tiles: a work-group refines filter_work_group_size positions against refine_query_tile query nodes.
+ * The query signatures and candidate words of the tile are staged once, then the tile is refined without barriers and
+ * the surviving bits of each word are gathered with a sub-group ballot.
+ */
+inline utils::BatchedEvent refineCandidatesTiled(sycl::queue& queue,
+                                                 sigmo::DeviceBatchedCSRGraph& query_graph,
+                                                 sigmo::signature::Signature<>& signatures,
+                                                 sigmo::candidates::Candidates& candidates,
+                                                 const std::vector<sycl::event>& depends = {}) {
+  using SignatureDevice = sigmo::signature::Signature<>::SignatureDevice;
+  const size_t total_query_nodes = query_graph.total_nodes;
+  const size_t total_positions = candidates.getCandidatesDevice().target_nodes;
+  const size_t tile = device::deviceOptions.refine_query_tile;
+  const size_t num_tiles = (total_query_nodes + tile - 1) / tile;
+  const size_t group_size = device::deviceOptions.filter_work_group_size;
+  const size_t words_per_group = group_size / candidates.getCandidatesDevice().num_bits;
+
+  sycl::range<2> local_range{1, group_size};
+  sycl::range<2> global_range{num_tiles, ((total_positions + group_size - 1) / group_size) * group_size};
 
   auto e = queue.submit([&](sycl::handler& cgh) {
-    sycl::local_accessor<types::candidates_t, 1> local_candidates(integers_per_wg, cgh);
+    cgh.depends_on(depends);
+    sycl::local_accessor<SignatureDevice, 1> local_signatures(tile, cgh);
+    sycl::local_accessor<types::candidates_t, 1> local_words(tile * words_per_group, cgh);
 
-    cgh.parallel_for<sigmo::device::kernels::RefineCandidatesKernel<D>>(
-        sycl::nd_range<1>({global_range, local_range}),
+    cgh.parallel_for<sigmo::device::kernels::RefineCandidatesTiledKernel>(
+        sycl::nd_range<2>({global_range, local_range}),
         [=,
          candidates = candidates.getCandidatesDevice(),
          query_signatures = signatures.getDeviceQuerySignatures(),
-         data_signatures = signatures.getDeviceDataSignatures(),
-         max_labels = signatures.getMaxLabels()](sycl::nd_item<1> item) {
-          auto data_node_id = item.get_global_id(0);
-          sigmo::signature::Signature<>::SignatureDevice data_signature{0};
-          if (data_node_id < total_data_nodes) { data_signature = data_signatures[data_node_id]; }
-
-          for (size_t query_node_id = 0; query_node_id < total_query_nodes; ++query_node_id) {
-            if (item.get_local_linear_id() < integers_per_wg) {
-              local_candidates[item.get_local_linear_id()]
-                  = candidates.candidates[(query_node_id * candidates.single_node_size) + (integers_per_wg * item.get_group_linear_id())
-                                          + item.get_local_linear_id()];
-            }
-            sycl::group_barrier(item.get_group());
-            sycl::atomic_ref<types::candidates_t, sycl::memory_order::relaxed, sycl::memory_scope::work_group> ref{
-                local_candidates[item.get_local_linear_id() / candidates.num_bits]};
-            size_t offset = data_node_id % candidates.num_bits;
+         data_signatures = signatures.getDeviceDataSignatures()](sycl::nd_item<2> item) {
+          const size_t tile_start = item.get_group(0) * tile;
+          const size_t tile_size = sycl::min(tile, total_query_nodes - tile_start);
+          const size_t first_word = item.get_group(1) * words_per_group;
+          const size_t local_id = item.get_local_linear_id();
+
+          for (size_t i = local_id; i < tile_size; i += group_size) { local_signatures[i] = query_signatures[tile_start + i]; }
+          for (size_t i = local_id; i < tile_size * words_per_group; i += group_size) {
+            size_t word = first_word + i % words_per_group;
+            size_t row = (tile_start + i / words_per_group) * candidates.single_node_size;
+            local_words[i] = word < candidates.single_node_size ? candidates.candidates[row + word] : 0;
+          }
+          sycl::group_barrier(item.get_group());
 
-            if (data_node_id < total_data_nodes && (ref & (static_cast<types::candidates_t>(1) << offset))) {
-              auto query_signature = query_signatures[query_node_id];
+          const size_t position = item.get_global_id(1);
+          const auto data_node_id = position < total_positions ? candidates.getNodeAt(position) : types::NULL_NODE;
+          SignatureDevice data_signature{0};
+          if (data_node_id != types::NULL_NODE) { data_signature = data_signatures[data_node_id]; }
 
-              bool keep = true;
-              for (types::label_t l = 0; l < max_labels && keep; l++) {
-                keep = keep && (query_signature.getLabelCount(l) <= data_signature.getLabelCount(l));
-              }
-              if (!keep) { ref &= ~(static_cast<types::candidates_t>(1) << offset); }
-            }
-            // if (!candidates.atomicContains(query_node_id, data_node_id)) { continue; }
-
-            sycl::group_barrier(item.get_group());
-            if (item.get_local_linear_id() < integers_per_wg) {
-              candidates.candidates[(query_node_id * candidates.single_node_size) + (integers_per_wg * item.get_group_linear_id())
-                                    + item.get_local_linear_id()]
-                  = local_candidates[item.get_local_linear_id()];
+          const auto sg = item.get_sub_group();
+          const uint32_t lane = sg.get_local_linear_id();
+          const uint32_t sg_size = sg.get_local_linear_range();
+          const bool full_words = sg_size >= candidates.num_bits;
+          const bool writer = lane % candidates.num_bits == 0 && position < total_positions;
+          const uint32_t shift = position % candidates.num_bits;
+          const types::candidates_t segment = full_words ? ~static_cast<types::candidates_t>(0)
+                                                         : ((static_cast<types::candidates_t>(1) << sg_size) - 1) << shift;
+          const size_t local_word = local_id / candidates.num_bits;
+
+          for (size_t q = 0; q < tile_size; ++q) {
+            const types::candidates_t word = local_words[q * words_per_group + local_word];
+            bool keep = (word & (static_cast<types::candidates_t>(1) << shift)) && data_signature.dominates(local_signatures[q]);
+            auto mask = sycl::ext::oneapi::group_ballot(sg, keep);
+            if (!writer) { continue; }
+            types::candidates_t kept = 0;
+            mask.extract_bits(kept, lane);
+            types::candidates_t removed = word & segment & ~(kept << shift);
+            if (removed == 0) { continue; }
+            if (full_words) {
+              candidates.setWord(tile_start + q, position / candidates.num_bits, word & ~removed);
+            } else {
+              candidates.atomicRemoveWord(tile_start + q, position / candidates.num_bits, removed);
             }
           }
         });
@@ -126,6 +180,111 @@ utils::BatchedEvent refineCandidates(sycl::queue& queue,
   return be;
 }
 
+template<CandidatesDomain D = CandidatesDomain::Query>
+utils::BatchedEvent refineCandidates(sycl::queue& queue,
+                                     sigmo::DeviceBatchedCSRGraph& query_graph,
+                                     sigmo::DeviceBatchedCSRGraph& data_graph,
+                                     sigmo::signature::Signature<>& signatures,
+                                     sigmo::candidates::Candidates& candidates,
+                                     const std::vector<sycl::event>& depends = {}) {
+  size_t total_query_nodes = query_graph.total_nodes;
+
+  if constexpr (D == CandidatesDomain::Data) {
+    // every work-item owns the row of a data node, so bits are cleared in place without staging or atomics
+    size_t total_data_nodes = data_graph.total_nodes;
+    sycl::range<1> local_range{device::deviceOptions.filter_work_group_size};
+    sycl::range<1> global_range{((total_data_nodes + local_range[0] - 1) / local_range[0]) * local_range[0]};
+
+    auto e = queue.submit([&](sycl::handler& cgh) {
+      cgh.depends_on(depends);
+      cgh.parallel_for<sigmo::device::kernels::RefineCandidatesKernel<D>>(
+          sycl::nd_range<1>({global_range, local_range}),
+          [=,
+           candidates = candidates.getCandidatesDevice(),
+           query_signatures = signatures.getDeviceQuerySignatures(),
+           data_signatures = signatures.getDeviceDataSignatures()](sycl::nd_item<1> item) {
+            auto data_node_id = item.get_global_id(0);
+            if (data_node_id >= total_data_nodes) { return; }
+            auto data_signature = data_signatures[data_node_id];
+            types::candidates_t* row = candidates.candidates + data_node_id * candidates.single_node_size;
+
+            for (size_t word = 0; word < candidates.single_node_size; ++word) {
+              types::candidates_t block = row[word];
+              for (types::candidates_t pending = block; pending != 0; pending &= pending - 1) {
+                auto bit = sycl::ctz(pending);
+                if (!data_signature.dominates(query_signatures[word * candidates.num_bits + bit])) {
+                  block &= ~(static_cast<types::candidates_t>(1) << bit);
+                }
+              }
+              row[word] = block;
+            }
+          });
+    });
+
+    utils::BatchedEvent be;
+    be.add(e);
+    candidates.invalidateSummary();
+    return be;
+  } else {
+    // the tiles address whole candidate words, so the work-group must span a multiple of them
+    const auto& options = device::deviceOptions;
+    if (options.refine_query_tile > 0 && options.filter_work_group_size % candidates.getCandidatesDevice().num_bits == 0) {
+      auto be = refineCandidatesTiled(queue, query_graph, signatures, candidates, depends);
+      candidates.invalidateSummary();
+      return be;
+    }
+    size_t total_positions = candidates.getCandidatesDevice().target_nodes;
+    sycl::range<1> local_range{device::deviceOptions.filter_work_group_size};
+    sycl::range<1> global_range{((total_positions + local_range[0] - 1) / local_range[0]) * local_range[0]};
+
+    size_t integers_per_wg = local_range[0] / candidates.getCandidatesDevice().num_bits;
+
+    auto e = queue.submit([&](sycl::handler& cgh) {
+      cgh.depends_on(depends);
+      sycl::local_accessor<types::candidates_t, 1> local_candidates(integers_per_wg, cgh);
+
+      cgh.parallel_for<sigmo::device::kernels::RefineCandidatesKernel<D>>(
+          sycl::nd_range<1>({global_range, local_range}),
+          [=,
+           candidates = candidates.getCandidatesDevice(),
+           query_signatures = signatures.getDeviceQuerySignatures(),
+           data_signatures = signatures.getDeviceDataSignatures()](sycl::nd_item<1> item) {
+            auto position = item.get_global_id(0);
+            auto data_node_id = position < total_positions ? candidates.getNodeAt(position) : types::NULL_NODE;
+            sigmo::signature::Signature<>::SignatureDevice data_signature{0};
+            if (data_node_id != types::NULL_NODE) { data_signature = data_signatures[data_node_id]; }
+            const size_t word_id = integers_per_wg * item.get_group_linear_id() + item.get_local_linear_id();
+            const bool stage_word = item.get_local_linear_id() < integers_per_wg && word_id < candidates.single_node_size;
+
+            for (size_t query_node_id = 0; query_node_id < total_query_nodes; ++query_node_id) {
+              if (stage_word) {
+                local_candidates[item.get_local_linear_id()] = candidates.candidates[(query_node_id * candidates.single_node_size) + word_id];
+              }
+              sycl::group_barrier(item.get_group());
+              sycl::atomic_ref<types::candidates_t, sycl::memory_order::relaxed, sycl::memory_scope::work_group> ref{
+                  local_candidates[item.get_local_linear_id() / candidates.num_bits]};
+              size_t offset = position % candidates.num_bits;
+
+              if (data_node_id != types::NULL_NODE && (ref & (static_cast<types::candidates_t>(1) << offset))) {
+                if (!data_signature.dominates(query_signatures[query_node_id])) { ref &= ~(static_cast<types::candidates_t>(1) << offset); }
+              }
+              // if (!candidates.atomicContains(query_node_id, data_node_id)) { continue; }
+
+              sycl::group_barrier(item.get_group());
+              if (stage_word) {
+                candidates.candidates[(query_node_id * candidates.single_node_size) + word_id] = local_candidates[item.get_local_linear_id()];
+              }
+            }
+          });
+    });
+
+    utils::BatchedEvent be;
+    be.add(e);
+    candidates.invalidateSummary();
+    return be;
+  }
+}
+
 } // namespace filter
 
 namespace join {
@@ -140,6 +299,32 @@ struct Stack {
   size_t candidateIdx;
 };
 
+/**
+ * Stack frame of the size-specialized join kernels, half the size of Stack.
+ */
+struct CompactStack {
+  uint8_t depth;
+  uint32_t candidateIdx;
+};
+
+using types::JOIN_DEPTH_CLASSES;
+
+/**
+ * Largest query the kernels working on whole data graphs (joinCandidates, joinWildcardCandidates) can hold.
+ */
+inline constexpr size_t JOIN_GRAPH_MAX_DEPTH = 30;
+
+/**
+ * Query graph staged in local memory by the join: the matching order and, for every position, the earlier positions
+ * adjacent to it (bit i of backward), so the DFS never reads the query CSR.
+ */
+template<size_t MaxDepth>
+struct QueryCache {
+  static_assert(MaxDepth <= 32, "backward neighbors are kept in a 32-bit mask");
+  types::node_t order[MaxDepth];
+  uint32_t backward[MaxDepth];
+};
+
 struct Mapping { // TODO: make it SOA
   size_t query_graph_id;
   size_t data_graph_id;
@@ -167,13 +352,16 @@ SYCL_EXTERNAL bool isValidMapping(types::node_t candidate,
   return true;
 }
 
+template<typename CandidatesT = sigmo::candidates::Candidates, size_t MaxDepth = 32>
 utils::BatchedEvent joinCandidates2(sycl::queue& queue,
                                     sigmo::DeviceBatchedCSRGraph& query_graphs,
                                     sigmo::DeviceBatchedCSRGraph& data_graphs,
-                                    sigmo::candidates::Candidates& candidates,
+                                    CandidatesT& candidates,
                                     sigmo::isomorphism::mapping::GMCR& gmcr,
                                     size_t* num_matches,
-                                    bool find_first = true) {
+                                    bool find_first = true,
+                                    const uint32_t* pair_ids = nullptr,
+                                    size_t num_pair_ids = 0) {
   utils::BatchedEvent e;
   const size_t total_query_nodes = query_graphs.total_nodes;
   const size_t total_data_nodes = data_graphs.total_nodes;
@@ -182,19 +370,21 @@ utils::BatchedEvent joinCandidates2(sycl::queue& queue,
 
   const size_t preferred_workgroup_size = device::deviceOptions.join_work_group_size;
 
-  size_t size = gmcr.getGMCRDevice().total_query_indices;
+  // pair_ids restricts the kernel to a subset of the GMCR entries
+  size_t size = pair_ids != nullptr ? num_pair_ids : gmcr.getGMCRDevice().total_query_indices;
 
   size_t global_size = ((size + preferred_workgroup_size - 1) / preferred_workgroup_size) * preferred_workgroup_size;
 
   sycl::nd_range<1> nd_range{global_size, preferred_workgroup_size};
-  constexpr size_t MAX_QUERY_NODES = 30;
+  constexpr size_t MAX_QUERY_NODES = MaxDepth;
   auto e1 = queue.submit([&](sycl::handler& cgh) {
-    cgh.parallel_for<device::kernels::JoinCandidates2Kernel>(
+    cgh.parallel_for<device::kernels::JoinCandidates2Kernel<CandidatesT, MaxDepth>>(
         nd_range,
         [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice(), gmcr = gmcr.getGMCRDevice()](
             sycl::nd_item<1> item) {
-          const size_t wgid = item.get_global_linear_id();
-          if (wgid >= size) { return; }
+          const size_t global_id = item.get_global_linear_id();
+          if (global_id >= size) { return; }
+          const size_t wgid = pair_ids != nullptr ? pair_ids[global_id] : global_id;
           const uint32_t query_graph_id = gmcr.query_graph_indices[wgid];
 
           sycl::atomic_ref<size_t, sycl::memory_order::relaxed, sycl::memory_scope::device> num_matches_ref{num_matches[0]};
@@ -207,9 +397,10 @@ utils::BatchedEvent joinCandidates2(sycl::queue& queue,
           const uint32_t start_data_graph = data_graphs.graph_offsets[data_graph_id];
           const uint32_t end_data_graph = data_graphs.graph_offsets[data_graph_id + 1];
 
-          Stack stack[MAX_QUERY_NODES]; // TODO: assume max depth of 30 but make it dynamic
+          CompactStack stack[MAX_QUERY_NODES + 1]; // one frame per query node plus the complete match
           const uint32_t offset_query_nodes = query_graphs.getPreviousNodes(query_graph_id);
           const uint16_t num_query_nodes = query_graphs.getGraphNodes(query_graph_id);
+          const auto slice = sigmo::candidates::getSlice(candidates, wgid, offset_query_nodes, data_graph_id, start_data_graph, end_data_graph);
 
           // start DFS
           utils::detail::Bitset<uint64_t> visited{start_data_graph};
@@ -224,6 +415,8 @@ utils::BatchedEvent joinCandidates2(sycl::queue& queue,
             if (frame.depth == num_query_nodes) { // found a match and output solution
               private_num_matches++;
               top--;
+              // the previous node moves on to its next candidate
+              visited.unset(mapping[frame.depth - 1]);
               if (find_first) {
                 break;
               } else {
@@ -231,18 +424,15 @@ utils::BatchedEvent joinCandidates2(sycl::queue& queue,
               }
             }
             // no more candidates
-            if (frame.candidateIdx >= candidates.getCandidatesCount(query_node + offset_query_nodes, start_data_graph, end_data_graph)) {
-              // backtrack
+            if (frame.candidateIdx >= slice.getCandidatesCount(query_node)) {
+              // backtrack, the previous node moves on to its next candidate
               top--;
-              // free the failed mapping
-              visited.unset(mapping[query_node]);
-              // clear visited if we are back to the first node
-              if (top == 1) { visited.clear(); }
+              if (frame.depth > 0) { visited.unset(mapping[frame.depth - 1]); }
               continue;
             }
 
             // try the next candidate
-            auto candidate = candidates.getCandidateAt(query_node + offset_query_nodes, frame.candidateIdx, start_data_graph, end_data_graph);
+            auto candidate = slice.getCandidateAt(query_node, frame.candidateIdx);
 
             // increment the candidate index for the next iteration
             stack[top - 1].candidateIdx++;
@@ -254,7 +444,7 @@ utils::BatchedEvent joinCandidates2(sycl::queue& queue,
             if ((frame.depth == 0 || isValidMapping(candidate, frame.depth, mapping, query_graphs, query_graph_id, data_graphs, data_graph_id))) {
               mapping[frame.depth] = candidate;
               visited.set(candidate);
-              stack[top++] = {frame.depth + 1, 0};
+              stack[top++] = {static_cast<uint8_t>(frame.depth + 1), 0};
             }
           }
 
@@ -267,13 +457,16 @@ utils::BatchedEvent joinCandidates2(sycl::queue& queue,
   return e;
 }
 
+template<typename CandidatesT = sigmo::candidates::Candidates>
 utils::BatchedEvent joinCandidates(sycl::queue& queue,
                                    sigmo::DeviceBatchedCSRGraph& query_graphs,
                                    sigmo::DeviceBatchedCSRGraph& data_graphs,
-                                   sigmo::candidates::Candidates& candidates,
+                                   CandidatesT& candidates,
                                    sigmo::isomorphism::mapping::GMCR& gmcr,
                                    size_t* num_matches,
-                                   bool find_first = true) {
+                                   bool find_first = true,
+                                   const uint32_t* data_graph_ids = nullptr,
+                                   size_t num_data_graph_ids = 0) {
   utils::BatchedEvent e;
   const size_t total_query_nodes = query_graphs.total_nodes;
   const size_t total_data_nodes = data_graphs.total_nodes;
@@ -284,10 +477,12 @@ utils::BatchedEvent joinCandidates(sycl::queue& queue,
 
   size_t global_size = ((total_data_graphs + preferred_workgroup_size - 1) / preferred_workgroup_size) * preferred_workgroup_size;
 
-  sycl::nd_range<1> nd_range{total_data_graphs * preferred_workgroup_size, preferred_workgroup_size};
+  // data_graph_ids restricts the kernel to a subset of the data graphs
+  const size_t num_groups = data_graph_ids != nullptr ? num_data_graph_ids : total_data_graphs;
+  sycl::nd_range<1> nd_range{num_groups * preferred_workgroup_size, preferred_workgroup_size};
   constexpr size_t MAX_QUERY_NODES = 30;
   auto e1 = queue.submit([&](sycl::handler& cgh) {
-    cgh.parallel_for<device::kernels::JoinCandidatesKernel>(
+    cgh.parallel_for<device::kernels::JoinCandidatesKernel<CandidatesT>>(
         nd_range,
         [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice(), gmcr = gmcr.getGMCRDevice()](
             sycl::nd_item<1> item) {
@@ -309,7 +504,8 @@ utils::BatchedEvent joinCandidates(sycl::queue& queue,
           types::node_t mapping[MAX_QUERY_NODES];
           size_t private_num_matches = 0;
 
-          for (uint32_t data_graph_id = wgid; data_graph_id < total_data_graphs; data_graph_id += wg.get_group_linear_range()) {
+          for (uint32_t group_it = wgid; group_it < num_groups; group_it += wg.get_group_linear_range()) {
+            const uint32_t data_graph_id = data_graph_ids != nullptr ? data_graph_ids[group_it] : group_it;
             const uint32_t start_data_graph = data_graphs.graph_offsets[data_graph_id];
             const uint32_t end_data_graph = data_graphs.graph_offsets[data_graph_id + 1];
 
@@ -322,6 +518,8 @@ utils::BatchedEvent joinCandidates(sycl::queue& queue,
               Stack stack[MAX_QUERY_NODES]; // TODO: assume max depth of 30 but make it dynamic
               const uint32_t offset_query_nodes = query_graphs.getPreviousNodes(query_graph_id);
               const uint16_t num_query_nodes = query_graphs.getGraphNodes(query_graph_id);
+              const auto slice = sigmo::candidates::getSlice(
+                  candidates, start_query + query_graph_it, offset_query_nodes, data_graph_id, start_data_graph, end_data_graph);
 
               // start DFS
               utils::detail::Bitset<uint64_t> visited{start_data_graph};
@@ -336,6 +534,8 @@ utils::BatchedEvent joinCandidates(sycl::queue& queue,
                 if (frame.depth == num_query_nodes) { // found a match and output solution
                   private_num_matches++;
                   top--;
+                  // the previous node moves on to its next candidate
+                  visited.unset(mapping[frame.depth - 1]);
                   if (find_first) {
                     break;
                   } else {
@@ -343,18 +543,15 @@ utils::BatchedEvent joinCandidates(sycl::queue& queue,
                   }
                 }
                 // no more candidates
-                if (frame.candidateIdx >= candidates.getCandidatesCount(query_node + offset_query_nodes, start_data_graph, end_data_graph)) {
-                  // backtrack
+                if (frame.candidateIdx >= slice.getCandidatesCount(query_node)) {
+                  // backtrack, the previous node moves on to its next candidate
                   top--;
-                  // free the failed mapping
-                  visited.unset(mapping[query_node]);
-                  // clear visited if we are back to the first node
-                  if (top == 1) { visited.clear(); }
+                  if (frame.depth > 0) { visited.unset(mapping[frame.depth - 1]); }
                   continue;
                 }
 
                 // try the next candidate
-                auto candidate = candidates.getCandidateAt(query_node + offset_query_nodes, frame.candidateIdx, start_data_graph, end_data_graph);
+                auto candidate = slice.getCandidateAt(query_node, frame.candidateIdx);
 
                 // increment the candidate index for the next iteration
                 stack[top - 1].candidateIdx++;
@@ -380,20 +577,14 @@ utils::BatchedEvent joinCandidates(sycl::queue& queue,
   return e;
 }
 
-SYCL_EXTERNAL void defineMatchingOrder(sycl::nd_item<1> item,
-                                       types::node_t* mapping,
-                                       size_t& max_candidates,
-                                       const sigmo::candidates::Candidates::CandidatesDevice& candidates,
-                                       uint query_graph_offsets,
-                                       uint total_query_nodes,
-                                       uint data_graph_start,
-                                       uint data_graph_end) {
+template<typename SliceT>
+SYCL_EXTERNAL void defineMatchingOrder(sycl::nd_item<1> item, types::node_t* mapping, size_t& max_candidates, const SliceT& slice, uint total_query_nodes) {
   uint sgid = item.get_sub_group().get_local_linear_id();
   int current_node = -1;
   int current_candidates = 0;
   if (sgid < total_query_nodes) {
     current_node = sgid;
-    current_candidates = candidates.getCandidatesCount(current_node + query_graph_offsets, data_graph_start, data_graph_end);
+    current_candidates = slice.getCandidatesCount(current_node);
   }
 
   max_candidates = sycl::reduce_over_group(item.get_sub_group(), current_candidates, sycl::maximum<>());
@@ -408,37 +599,55 @@ SYCL_EXTERNAL void defineMatchingOrder(sycl::nd_item<1> item,
   }
 }
 
-SYCL_EXTERNAL bool isValidMapping(types::node_t candidate,
-                                  uint depth,
-                                  const types::node_t* matching_order,
-                                  const uint32_t* mapping,
-                                  const sigmo::DeviceBatchedCSRGraph& query_graphs,
-                                  uint query_graph_id,
-                                  const sigmo::DeviceBatchedCSRGraph& data_graphs,
-                                  uint data_graph_id) {
-  for (int i = 0; i < depth; i++) {
-    size_t query_nodes_offset = query_graphs.getPreviousNodes(query_graph_id);
-
-    bool isQueryNeighbor = query_graphs.isNeighbor(matching_order[i] + query_nodes_offset, matching_order[depth] + query_nodes_offset);
-
-    if ((isQueryNeighbor != data_graphs.isNeighbor(mapping[matching_order[i]], candidate))
-        || ((isQueryNeighbor)
-            && (data_graphs.getEdgeLabel(mapping[matching_order[i]], candidate)
-                != query_graphs.getEdgeLabel(matching_order[i] + query_nodes_offset, matching_order[depth] + query_nodes_offset)))) {
-      return false;
+/**
+ * Stage a query graph in the cache shared by a group, each member fills a strided subset of the positions.
+ */
+template<size_t MaxDepth, typename GroupT>
+SYCL_EXTERNAL void stageQueryGraph(GroupT group,
+                                   QueryCache<MaxDepth>& cache,
+                                   const types::node_t* order,
+                                   uint num_query_nodes,
+                                   const sigmo::DeviceBatchedCSRGraph& query_graphs,
+                                   uint query_graph_id) {
+  const size_t query_nodes_offset = query_graphs.getPreviousNodes(query_graph_id);
+  for (uint d = group.get_local_linear_id(); d < num_query_nodes; d += group.get_local_linear_range()) {
+    uint32_t backward = 0;
+    for (uint i = 0; i < d; i++) {
+      if (!query_graphs.isNeighbor(order[i] + query_nodes_offset, order[d] + query_nodes_offset)) { continue; }
+      backward |= 1u << i;
     }
+    cache.order[d] = order[d];
+    cache.backward[d] = backward;
   }
+  sycl::group_barrier(group);
+}
 
+/**
+ * isValidMapping on a staged query graph, mapping is indexed by position in the matching order.
+ */
+template<size_t MaxDepth>
+SYCL_EXTERNAL bool isValidMapping(types::node_t candidate,
+                                  uint depth,
+                                  const QueryCache<MaxDepth>& cache,
+                                  const types::node_t* mapping,
+                                  const sigmo::DeviceBatchedCSRGraph& data_graphs) {
+  const uint32_t backward = cache.backward[depth];
+  for (uint i = 0; i < depth; i++) {
+    if (((backward >> i) & 1u) != data_graphs.isNeighbor(mapping[i], candidate)) { return false; }
+  }
   return true;
 }
 
+template<typename CandidatesT = sigmo::candidates::Candidates>
 utils::BatchedEvent joinWildcardCandidates(sycl::queue& queue,
                                            sigmo::DeviceBatchedCSRGraph& query_graphs,
                                            sigmo::DeviceBatchedCSRGraph& data_graphs,
-                                           sigmo::candidates::Candidates& candidates,
+                                           CandidatesT& candidates,
                                            sigmo::isomorphism::mapping::GMCR& gmcr,
                                            size_t* num_matches,
-                                           bool find_first = true) {
+                                           bool find_first = true,
+                                           const uint32_t* data_graph_ids = nullptr,
+                                           size_t num_data_graph_ids = 0) {
   utils::BatchedEvent e;
   const size_t total_query_nodes = query_graphs.total_nodes;
   const size_t total_data_nodes = data_graphs.total_nodes;
@@ -449,10 +658,24 @@ utils::BatchedEvent joinWildcardCandidates(sycl::queue& queue,
 
   size_t global_size = ((total_data_graphs + preferred_workgroup_size - 1) / preferred_workgroup_size) * preferred_workgroup_size;
 
-  sycl::nd_range<1> nd_range{total_data_graphs * preferred_workgroup_size, preferred_workgroup_size};
   constexpr size_t MAX_QUERY_NODES = 30;
+  // one staged query graph per sub-group, sized for the narrowest sub-group the device runs: the work-group is shrunk
+  // until the staged query graphs fit the local memory
+  const auto sub_group_sizes = queue.get_device().get_info<sycl::info::device::sub_group_sizes>();
+  const size_t min_sub_group_size = *std::min_element(sub_group_sizes.begin(), sub_group_sizes.end());
+  const size_t local_mem_size = queue.get_device().get_info<sycl::info::device::local_mem_size>();
+  const size_t fitting_sub_groups = local_mem_size / sizeof(QueryCache<MAX_QUERY_NODES>);
+  if (fitting_sub_groups == 0) { throw std::runtime_error("joinWildcardCandidates: a staged query graph does not fit the local memory"); }
+  const size_t workgroup_size = std::min(preferred_workgroup_size, fitting_sub_groups * min_sub_group_size);
+  const size_t max_sub_groups = (workgroup_size + min_sub_group_size - 1) / min_sub_group_size;
+
+  // data_graph_ids restricts the kernel to a subset of the data graphs
+  const size_t num_groups = data_graph_ids != nullptr ? num_data_graph_ids : total_data_graphs;
+  sycl::nd_range<1> nd_range{num_groups * workgroup_size, workgroup_size};
   auto e1 = queue.submit([&](sycl::handler& cgh) {
-    cgh.parallel_for<device::kernels::JoinWildcardCandidatesKernel>(
+    sycl::local_accessor<QueryCache<MAX_QUERY_NODES>, 1> query_cache(max_sub_groups, cgh);
+
+    cgh.parallel_for<device::kernels::JoinWildcardCandidatesKernel<CandidatesT>>(
         nd_range,
         [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice(), gmcr = gmcr.getGMCRDevice()](
             sycl::nd_item<1> item) {
@@ -475,7 +698,8 @@ utils::BatchedEvent joinWildcardCandidates(sycl::queue& queue,
           types::node_t mapping[MAX_QUERY_NODES];
           size_t private_num_matches = 0;
 
-          for (uint32_t data_graph_id = wgid; data_graph_id < total_data_graphs; data_graph_id += wg.get_group_linear_range()) {
+          for (uint32_t group_it = wgid; group_it < num_groups; group_it += wg.get_group_linear_range()) {
+            const uint32_t data_graph_id = data_graph_ids != nullptr ? data_graph_ids[group_it] : group_it;
             const uint32_t start_data_graph = data_graphs.graph_offsets[data_graph_id];
             const uint32_t end_data_graph = data_graphs.graph_offsets[data_graph_id + 1];
 
@@ -490,48 +714,50 @@ utils::BatchedEvent joinWildcardCandidates(sycl::queue& queue,
               Stack stack[MAX_QUERY_NODES]; // TODO: assume max depth of 30 but make it dynamic
               const uint32_t offset_query_nodes = query_graphs.getPreviousNodes(query_graph_id);
               const uint16_t num_query_nodes = query_graphs.getGraphNodes(query_graph_id);
-
-              defineMatchingOrder(
-                  item, matching_order, max_candidates, candidates, offset_query_nodes, num_query_nodes, start_data_graph, end_data_graph);
-
-              for (size_t starting_candidate = sglid; starting_candidate < max_candidates; starting_candidate += sgsize) {
-                // start DFS
+              const auto slice = sigmo::candidates::getSlice(
+                  candidates, start_query + query_graph_it, offset_query_nodes, data_graph_id, start_data_graph, end_data_graph);
+
+              defineMatchingOrder(item, matching_order, max_candidates, slice, num_query_nodes);
+              auto& cache = query_cache[sgid];
+              sycl::group_barrier(sg); // every lane is done with the previous query graph
+              stageQueryGraph(sg, cache, matching_order, num_query_nodes, query_graphs, query_graph_id);
+
+              size_t pair_matches = 0;
+              for (size_t starting_candidate = sglid; starting_candidate < max_candidates && !(find_first && pair_matches > 0);
+                   starting_candidate += sgsize) {
+                // start DFS, mapping is indexed by position in the matching order
                 utils::detail::Bitset<uint64_t> visited{start_data_graph};
                 uint top = 0;
-                mapping[matching_order[0]]
-                    = candidates.getCandidateAt(matching_order[0] + offset_query_nodes, starting_candidate, start_data_graph, end_data_graph);
-                visited.set(mapping[matching_order[0]]);
+                mapping[0] = slice.getCandidateAt(cache.order[0], starting_candidate);
+                visited.set(mapping[0]);
                 stack[top++] = {1, 0}; // initialize stack with the first node
                 // DFS loop
                 while (top > 0) {
                   // get the top frame
                   auto frame = stack[top - 1];
-                  auto query_node = matching_order[frame.depth];
 
                   if (frame.depth == num_query_nodes) { // found a match and output solution
-                    private_num_matches++;
+                    pair_matches++;
                     top--;
+                    // the previous position moves on to its next candidate
+                    visited.unset(mapping[frame.depth - 1]);
                     if (find_first) {
                       break;
                     } else {
                       continue;
                     }
                   }
+                  auto query_node = cache.order[frame.depth];
                   // no more candidates
-                  if (frame.candidateIdx >= candidates.getCandidatesCount(query_node + offset_query_nodes, start_data_graph, end_data_graph)) {
-                    // backtrack
+                  if (frame.candidateIdx >= slice.getCandidatesCount(query_node)) {
+                    // backtrack, the previous position moves on to its next candidate
                     top--;
-                    // free the failed mapping
-                    visited.unset(mapping[query_node]);
-                    if (top == 1) {
-                      visited.clear();
-                      visited.set(mapping[matching_order[0]]);
-                    }
+                    visited.unset(mapping[frame.depth - 1]);
                     continue;
                   }
 
                   // try the next candidate
-                  auto candidate = candidates.getCandidateAt(query_node + offset_query_nodes, frame.candidateIdx, start_data_graph, end_data_graph);
+                  auto candidate = slice.getCandidateAt(query_node, frame.candidateIdx);
 
                   // increment the candidate index for the next iteration
                   stack[top - 1].candidateIdx++;
@@ -540,14 +766,19 @@ utils::BatchedEvent joinWildcardCandidates(sycl::queue& queue,
                   if (visited.get(candidate)) { continue; }
 
                   // check if the candidate is valid
-                  if ((frame.depth == 0
-                       || isValidMapping(candidate, frame.depth, matching_order, mapping, query_graphs, query_graph_id, data_graphs, wgid))) {
-                    mapping[matching_order[frame.depth]] = candidate;
+                  if (frame.depth == 0 || isValidMapping(candidate, frame.depth, cache, mapping, data_graphs)) {
+                    mapping[frame.depth] = candidate;
                     visited.set(candidate);
                     stack[top++] = {frame.depth + 1, 0};
                   }
                 }
               }
+              // the lanes share the pair: with find_first it counts once, whichever lane found it
+              if (find_first) {
+                pair_matches = sycl::any_of_group(sg, pair_matches > 0);
+                if (sglid != 0) { pair_matches = 0; }
+              }
+              private_num_matches += pair_matches;
             }
           }
           private_num_matches = sycl::reduce_over_group(wg, private_num_matches, sycl::plus<>());
@@ -559,6 +790,721 @@ utils::BatchedEvent joinWildcardCandidates(sycl::queue& queue,
   return e;
 }
 
+/**
+ * Sub-group cooperative variant of joinCandidates2: every sub-group runs the DFS of one pair on a stack shared by its lanes.
+ * At each depth the lanes test a chunk of consecutive candidates in parallel, the survivors are gathered with a ballot
+ * and the DFS descends into them one at a time, so candidate verification no longer diverges across lanes.
+ */
+template<typename CandidatesT = sigmo::candidates::Candidates, size_t MaxDepth = 32>
+utils::BatchedEvent joinCooperativeCandidates(sycl::queue& queue,
+                                              sigmo::DeviceBatchedCSRGraph& query_graphs,
+                                              sigmo::DeviceBatchedCSRGraph& data_graphs,
+                                              CandidatesT& candidates,
+                                              sigmo::isomorphism::mapping::GMCR& gmcr,
+                                              size_t* num_matches,
+                                              bool find_first = true,
+                                              const uint32_t* pair_ids = nullptr,
+                                              size_t num_pair_ids = 0) {
+  utils::BatchedEvent e;
+  const size_t total_data_graphs = data_graphs.num_graphs;
+  const size_t preferred_workgroup_size = device::deviceOptions.join_work_group_size;
+
+  // pair_ids restricts the kernel to a subset of the GMCR entries
+  const size_t size = pair_ids != nullptr ? num_pair_ids : gmcr.getGMCRDevice().total_query_indices;
+  if (size == 0) { return e; }
+
+  // enough work-groups for one pair per sub-group of 32 lanes, narrower sub-groups stride over the remaining pairs
+  const size_t num_work_groups = (size * 32 + preferred_workgroup_size - 1) / preferred_workgroup_size;
+  sycl::nd_range<1> nd_range{num_work_groups * preferred_workgroup_size, preferred_workgroup_size};
+  constexpr size_t MAX_QUERY_NODES = MaxDepth;
+  constexpr uint32_t MAX_LANES = 32; // width of a survivors mask
+  auto e1 = queue.submit([&](sycl::handler& cgh) {
+    cgh.parallel_for<device::kernels::JoinCooperativeCandidatesKernel<CandidatesT, MaxDepth>>(
+        nd_range,
+        [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice(), gmcr = gmcr.getGMCRDevice()](
+            sycl::nd_item<1> item) {
+          const auto sg = item.get_sub_group();
+          const uint32_t sglid = sg.get_local_linear_id();
+          const uint32_t lanes = sycl::min<uint32_t>(sg.get_local_range()[0], MAX_LANES);
+          const size_t sg_global_id = item.get_group_linear_id() * sg.get_group_linear_range() + sg.get_group_linear_id();
+          const size_t num_sub_groups = item.get_group_range(0) * sg.get_group_linear_range();
+
+          types::node_t mapping[MAX_QUERY_NODES];
+          uint32_t chunk_start[MAX_QUERY_NODES]; // first candidate of the chunk under test at each depth
+          uint32_t survivors[MAX_QUERY_NODES];   // candidates of the chunk not explored yet, one bit per lane
+          size_t private_num_matches = 0;
+
+          for (size_t it = sg_global_id; it < size; it += num_sub_groups) {
+            const uint32_t pair_id = pair_ids != nullptr ? pair_ids[it] : it;
+            const uint32_t query_graph_id = gmcr.query_graph_indices[pair_id];
+            const uint32_t data_graph_id = utils::binarySearch(gmcr.data_graph_offsets, total_data_graphs, pair_id);
+            const uint32_t start_data_graph = data_graphs.graph_offsets[data_graph_id];
+            const uint32_t end_data_graph = data_graphs.graph_offsets[data_graph_id + 1];
+            const uint32_t offset_query_nodes = query_graphs.getPreviousNodes(query_graph_id);
+            const uint16_t num_query_nodes = query_graphs.getGraphNodes(query_graph_id);
+            const auto slice = sigmo::candidates::getSlice(candidates, pair_id, offset_query_nodes, data_graph_id, start_data_graph, end_data_graph);
+
+            // every lane tests one candidate of the chunk, the ballot is uniform across the sub-group
+            auto testChunk = [&](uint depth, uint32_t start) {
+              const uint32_t idx = start + sglid;
+              bool valid = sglid < lanes && idx < slice.getCandidatesCount(depth);
+              if (valid) {
+                const types::node_t candidate = slice.getCandidateAt(depth, idx);
+                for (uint i = 0; i < depth && valid; i++) { valid = mapping[i] != candidate; }
+                valid = valid && isValidMapping(candidate, depth, mapping, query_graphs, query_graph_id, data_graphs, data_graph_id);
+              }
+              uint32_t bits = 0;
+              sycl::ext::oneapi::group_ballot(sg, valid).extract_bits(bits);
+              return bits;
+            };
+
+            size_t pair_matches = 0;
+            uint depth = 0;
+            chunk_start[0] = 0;
+            survivors[0] = testChunk(0, 0);
+            while (true) {
+              if (survivors[depth] == 0) { // chunk exhausted: test the next one or backtrack
+                chunk_start[depth] += lanes;
+                if (chunk_start[depth] < slice.getCandidatesCount(depth)) {
+                  survivors[depth] = testChunk(depth, chunk_start[depth]);
+                } else if (depth == 0) {
+                  break;
+                } else {
+                  depth--;
+                }
+                continue;
+              }
+              if (depth + 1 == num_query_nodes) { // every survivor of the last depth completes a match
+                pair_matches += sycl::popcount(survivors[depth]);
+                survivors[depth] = 0;
+                if (find_first) { break; }
+                continue;
+              }
+              const uint32_t bit = sycl::ctz(survivors[depth]);
+              survivors[depth] &= survivors[depth] - 1;
+              mapping[depth] = slice.getCandidateAt(depth, chunk_start[depth] + bit);
+              depth++;
+              chunk_start[depth] = 0;
+              survivors[depth] = testChunk(depth, 0);
+            }
+            if (sg.leader()) { private_num_matches += find_first ? sycl::min<size_t>(pair_matches, 1) : pair_matches; }
+          }
+
+          sycl::atomic_ref<size_t, sycl::memory_order::relaxed, sycl::memory_scope::device> num_matches_ref{num_matches[0]};
+          if (private_num_matches > 0) num_matches_ref += private_num_matches;
+        });
+  });
+
+  e.add(e1);
+  return e;
+}
+
+enum class JoinPolicy { Auto, Graph, Pair, Wildcard, Cooperative };
+
+/**
+ * Route the GMCR pairs to the join kernel suited to their shape and record the share of the work each kernel handled:
+ * - in find-all runs, data graphs with a query node of at least join_wide_candidates candidates go to joinWildcardCandidates,
+ *   which spreads the first level of the search over a sub-group;
+ * - data graphs with at least join_dense_pairs pairs keep a work-group busy and go to joinCandidates;
+ * - the pairs of the remaining data graphs go to joinCandidates2, one work-item each.
+ * The other policies send every pair to a single kernel, Cooperative sends them to joinCooperativeCandidates.
+ * The per-pair kernels are launched once per query size class (JOIN_DEPTH_CLASSES) with the smallest fitting instantiation;
+ * data graphs with a query larger than JOIN_GRAPH_MAX_DEPTH always take the per-pair path and pairs beyond the largest class are skipped.
+ * With join_heavy_first the data graphs are scheduled in decreasing load: bucketed by the power of two of their pairs, then
+ * by node count and candidate volume. The kernels read the original data graph and pair ids from the schedule, so the
+ * matches need no remapping.
+ * The kernels are launched back to back, each counting into the counter of its share, and the counters are folded into
+ * num_matches once they are all done. The matches and time of every share are only read back with collect_stats.
+ */
+class JoinDispatcher {
+public:
+  struct Share {
+    const char* kernel;
+    size_t data_graphs = 0;
+    size_t pairs = 0;
+    size_t matches = 0;
+    std::chrono::duration<double> time{0};
+  };
+
+  JoinDispatcher(sycl::queue& queue, JoinPolicy policy = JoinPolicy::Auto, bool collect_stats = false)
+      : queue(queue), policy(policy), collect_stats(collect_stats) {}
+
+  template<typename CandidatesT>
+  utils::BatchedEvent run(sigmo::DeviceBatchedCSRGraph& query_graphs,
+                          sigmo::DeviceBatchedCSRGraph& data_graphs,
+                          CandidatesT& candidates,
+                          sigmo::isomorphism::mapping::GMCR& gmcr,
+                          size_t* num_matches,
+                          bool find_first = true) {
+    const size_t total_data_graphs = data_graphs.num_graphs;
+    const auto& options = device::deviceOptions;
+    std::vector<uint32_t> offsets(total_data_graphs + 1);
+    queue.copy(gmcr.getGMCRDevice().data_graph_offsets, offsets.data(), total_data_graphs + 1).wait();
+
+    std::vector<GraphLoad> loads(total_data_graphs);
+    if ((policy == JoinPolicy::Auto && !find_first) || options.join_heavy_first) {
+      loads = getGraphLoads(query_graphs, data_graphs, candidates, gmcr);
+    }
+    const std::vector<uint32_t> pair_sizes = getPairQuerySizes(query_graphs, gmcr);
+    oversized_pairs = 0;
+
+    std::vector<uint32_t> schedule(total_data_graphs);
+    std::iota(schedule.begin(), schedule.end(), 0);
+    if (options.join_heavy_first) { schedule = getHeavyFirstSchedule(data_graphs, offsets, loads); }
+
+    std::vector<uint32_t> graph_ids, pair_ids, wildcard_ids, cooperative_ids;
+    shares = {Share{"joinCandidates"}, Share{"joinCandidates2"}, Share{"joinWildcardCandidates"}, Share{"joinCooperativeCandidates"}};
+    for (uint32_t data_graph_id : schedule) {
+      const uint32_t pairs = offsets[data_graph_id + 1] - offsets[data_graph_id];
+      if (pairs == 0) continue;
+      JoinPolicy target = policy;
+      const uint32_t largest_query = *std::max_element(pair_sizes.begin() + offsets[data_graph_id], pair_sizes.begin() + offsets[data_graph_id + 1]);
+      if (largest_query > JOIN_GRAPH_MAX_DEPTH && (policy == JoinPolicy::Graph || policy == JoinPolicy::Wildcard || policy == JoinPolicy::Auto)) {
+        target = JoinPolicy::Pair;
+      } else if (policy == JoinPolicy::Auto) {
+        if (!find_first && loads[data_graph_id].widest >= options.join_wide_candidates) {
+          target = JoinPolicy::Wildcard;
+        } else {
+          target = pairs >= options.join_dense_pairs ? JoinPolicy::Graph : JoinPolicy::Pair;
+        }
+      }
+      if (target == JoinPolicy::Graph) {
+        graph_ids.push_back(data_graph_id);
+      } else if (target == JoinPolicy::Wildcard) {
+        wildcard_ids.push_back(data_graph_id);
+      } else {
+        auto& ids = target == JoinPolicy::Cooperative ? cooperative_ids : pair_ids;
+        for (uint32_t pair_id = offsets[data_graph_id]; pair_id < offsets[data_graph_id + 1]; ++pair_id) { ids.push_back(pair_id); }
+      }
+      auto& share = shares[static_cast<int>(target) - 1];
+      share.data_graphs++;
+      share.pairs += pairs;
+    }
+
+    utils::BatchedEvent ret;
+    share_matches = device::memory::malloc<size_t>(shares.size(), queue);
+    queue.fill(share_matches, size_t{0}, shares.size()).wait();
+    share_events.assign(shares.size(), {});
+    if (!graph_ids.empty()) {
+      const uint32_t* ids = toDevice(graph_ids);
+      record(0, ret, [&](size_t* counter) {
+        return joinCandidates(queue, query_graphs, data_graphs, candidates, gmcr, counter, find_first, ids, graph_ids.size());
+      });
+    }
+    runBySize(1, ret, pair_ids, pair_sizes, [&]<size_t MaxDepth>(size_t* counter, const uint32_t* ids, size_t num_ids) {
+      return joinCandidates2<CandidatesT, MaxDepth>(queue, query_graphs, data_graphs, candidates, gmcr, counter, find_first, ids, num_ids);
+    });
+    if (!wildcard_ids.empty()) {
+      const uint32_t* ids = toDevice(wildcard_ids);
+      record(2, ret, [&](size_t* counter) {
+        return joinWildcardCandidates(queue, query_graphs, data_graphs, candidates, gmcr, counter, find_first, ids, wildcard_ids.size());
+      });
+    }
+    runBySize(3, ret, cooperative_ids, pair_sizes, [&]<size_t MaxDepth>(size_t* counter, const uint32_t* ids, size_t num_ids) {
+      return joinCooperativeCandidates<CandidatesT, MaxDepth>(queue, query_graphs, data_graphs, candidates, gmcr, counter, find_first, ids, num_ids);
+    });
+
+    // a single synchronization for all the launches, then the shares are folded into the caller's counter
+    ret.wait();
+    const size_t num_shares = shares.size();
+    auto fold = queue.single_task([=, counters = share_matches]() {
+      for (size_t i = 0; i < num_shares; ++i) { num_matches[0] += counters[i]; }
+    });
+    fold.wait();
+    ret.add(fold);
+    if (collect_stats) {
+      std::vector<size_t> matches(num_shares);
+      queue.copy(share_matches, matches.data(), num_shares).wait();
+      for (size_t i = 0; i < num_shares; ++i) {
+        shares[i].matches = matches[i];
+        if (share_events[i].numEvents() > 0) { shares[i].time = share_events[i].getProfilingInfo(); }
+      }
+    }
+    for (auto* ids : id_buffers) { sycl::free(ids, queue); }
+    id_buffers.clear();
+    sycl::free(share_matches, queue);
+    share_matches = nullptr;
+    return ret;
+  }
+
+  const std::vector<Share>& getShares() const { return shares; }
+  size_t getOversizedPairs() const { return oversized_pairs; }
+
+private:
+  sycl::queue& queue;
+  JoinPolicy policy;
+  bool collect_stats;
+  std::vector<Share> shares;
+  size_t oversized_pairs = 0;
+  size_t* share_matches = nullptr;                 // one device counter per share
+  std::vector<utils::BatchedEvent> share_events;   // the launches of every share
+  std::vector<uint32_t*> id_buffers;               // freed once the launches are done
+
+  const uint32_t* toDevice(const std::vector<uint32_t>& values) {
+    uint32_t* ptr = device::memory::malloc<uint32_t>(values.size(), queue);
+    queue.copy(values.data(), ptr, values.size()).wait();
+    id_buffers.push_back(ptr);
+    return ptr;
+  }
+
+  template<typename LaunchT>
+  void record(size_t share_id, utils::BatchedEvent& events, LaunchT launch) {
+    auto e = launch(share_matches + share_id);
+    share_events[share_id].add(e.getLastEvent());
+    events.add(e.getLastEvent());
+  }
+
+  /**
+   * Split the pairs by query size class and launch the smallest instantiation of the kernel for each class.
+   */
+  template<typename LaunchT>
+  void runBySize(size_t share_id,
+                 utils::BatchedEvent& events,
+                 const std::vector<uint32_t>& pair_ids,
+                 const std::vector<uint32_t>& pair_sizes,
+                 LaunchT launch) {
+    constexpr size_t num_classes = std::size(JOIN_DEPTH_CLASSES);
+    std::vector<uint32_t> buckets[num_classes];
+    for (auto pair_id : pair_ids) {
+      size_t c = 0;
+      while (c < num_classes && pair_sizes[pair_id] > JOIN_DEPTH_CLASSES[c]) { c++; }
+      if (c == num_classes) {
+        oversized_pairs++;
+      } else {
+        buckets[c].push_back(pair_id);
+      }
+    }
+    [&]<size_t... C>(std::index_sequence<C...>) {
+      ((buckets[C].empty() ? void() : launchBucket<JOIN_DEPTH_CLASSES[C]>(share_id, events, buckets[C], launch)), ...);
+    }(std::make_index_sequence<num_classes>{});
+  }
+
+  template<size_t MaxDepth, typename LaunchT>
+  void launchBucket(size_t share_id, utils::BatchedEvent& events, const std::vector<uint32_t>& bucket, LaunchT& launch) {
+    const uint32_t* ids = toDevice(bucket);
+    record(share_id, events, [&](size_t* counter) { return launch.template operator()<MaxDepth>(counter, ids, bucket.size()); });
+  }
+
+  /**
+   * Get the number of query nodes of every GMCR pair.
+   */
+  std::vector<uint32_t> getPairQuerySizes(sigmo::DeviceBatchedCSRGraph& query_graphs, sigmo::isomorphism::mapping::GMCR& gmcr) {
+    const auto gmcr_device = gmcr.getGMCRDevice();
+    std::vector<uint32_t> query_indices(gmcr_device.total_query_indices);
+    std::vector<types::row_offset_t> query_offsets(query_graphs.num_graphs + 1);
+    queue.copy(gmcr_device.query_graph_indices, query_indices.data(), query_indices.size()).wait();
+    queue.copy(query_graphs.graph_offsets, query_offsets.data(), query_offsets.size()).wait();
+    std::vector<uint32_t> sizes(query_indices.size());
+    for (size_t i = 0; i < query_indices.size(); ++i) { sizes[i] = query_offsets[query_indices[i] + 1] - query_offsets[query_indices[i]]; }
+    return sizes;
+  }
+
+  struct GraphLoad {
+    uint32_t widest = 0; // largest candidate count of a query node
+    uint32_t volume = 0; // candidates over all the pairs
+  };
+
+  /**
+   * Get the candidate load of every data graph over its pairs.
+   */
+  template<typename CandidatesT>
+  std::vector<GraphLoad> getGraphLoads(sigmo::DeviceBatchedCSRGraph& query_graphs,
+                                       sigmo::DeviceBatchedCSRGraph& data_graphs,
+                                       CandidatesT& candidates,
+                                       sigmo::isomorphism::mapping::GMCR& gmcr) {
+    const size_t total_data_graphs = data_graphs.num_graphs;
+    GraphLoad* d_loads = device::memory::malloc<GraphLoad>(total_data_graphs, queue);
+    auto e = queue.parallel_for(
+        sycl::range<1>(total_data_graphs),
+        [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice(), gmcr = gmcr.getGMCRDevice()](
+            sycl::id<1> idx) {
+          const uint32_t data_graph_id = idx[0];
+          const uint32_t start_data_graph = data_graphs.graph_offsets[data_graph_id];
+          const uint32_t end_data_graph = data_graphs.graph_offsets[data_graph_id + 1];
+          GraphLoad load;
+          for (uint32_t pair_id = gmcr.data_graph_offsets[data_graph_id]; pair_id < gmcr.data_graph_offsets[data_graph_id + 1]; ++pair_id) {
+            const uint32_t query_graph_id = gmcr.query_graph_indices[pair_id];
+            const uint32_t offset_query_nodes = query_graphs.getPreviousNodes(query_graph_id);
+            const auto slice = sigmo::candidates::getSlice(candidates, pair_id, offset_query_nodes, data_graph_id, start_data_graph, end_data_graph);
+            for (uint32_t u = 0; u < query_graphs.getGraphNodes(query_graph_id); ++u) {
+              load.widest = sycl::max(load.widest, slice.getCandidatesCount(u));
+              load.volume += slice.getCandidatesCount(u);
+            }
+          }
+          d_loads[data_graph_id] = load;
+        });
+    e.wait();
+    std::vector<GraphLoad> loads(total_data_graphs);
+    queue.copy(d_loads, loads.data(), total_data_graphs).wait();
+    sycl::free(d_loads, queue);
+    return loads;
+  }
+
+  /**
+   * Order the data graphs by decreasing (log2 of the pairs, nodes, candidate volume).
+   */
+  std::vector<uint32_t> getHeavyFirstSchedule(sigmo::DeviceBatchedCSRGraph& data_graphs,
+                                              const std::vector<uint32_t>& offsets,
+                                              const std::vector<GraphLoad>& loads) {
+    const size_t total_data_graphs = data_graphs.num_graphs;
+    std::vector<types::row_offset_t> graph_offsets(total_data_graphs + 1);
+    queue.copy(data_graphs.graph_offsets, graph_offsets.data(), total_data_graphs + 1).wait();
+    std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> keys(total_data_graphs);
+    for (size_t i = 0; i < total_data_graphs; ++i) {
+      const uint32_t pairs = offsets[i + 1] - offsets[i];
+      keys[i] = {pairs == 0 ? 0 : std::bit_width(pairs), graph_offsets[i + 1] - graph_offsets[i], loads[i].volume};
+    }
+    std::vector<uint32_t> schedule(total_data_graphs);
+    std::iota(schedule.begin(), schedule.end(), 0);
+    std::stable_sort(schedule.begin(), schedule.end(), [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+    return schedule;
+  }
+};
+
+/**
+ * Join every data graph against the query trie with a single DFS, one work-item per data graph: a prefix shared by
+ * several queries is embedded once and every trie node reached counts a match for the queries ending there that are
+ * paired with the data graph in the GMCR. Subtrees without a paired query are skipped.
+ * Candidates are the data graph nodes with the label of the trie node: the candidate bitmaps are per query node and
+ * cannot be shared by the queries of a prefix, while the filter being sound keeps the counts of the per-pair kernels.
+ * query_matches, if given, receives the matches of every query graph. Find-all only.
+ */
+inline utils::BatchedEvent joinTrie(sycl::queue& queue,
+                                    sigmo::DeviceBatchedCSRGraph& data_graphs,
+                                    sigmo::isomorphism::trie::QueryTrie& trie,
+                                    sigmo::isomorphism::mapping::GMCR& gmcr,
+                                    size_t* num_matches,
+                                    size_t* query_matches = nullptr) {
+  using QueryTrie = sigmo::isomorphism::trie::QueryTrie;
+  struct TrieFrame {
+    uint32_t child;           // trie node under test at this depth
+    uint32_t child_end;       // end of its siblings
+    types::node_t next_node;  // next data node to test against it
+  };
+  utils::BatchedEvent e;
+  const size_t total_data_graphs = data_graphs.num_graphs;
+
+  auto e1 = queue.parallel_for<device::kernels::JoinTrieKernel>(
+      sycl::range<1>(total_data_graphs),
+      [=, data_graphs = data_graphs, trie = trie.getQueryTrieDevice(), gmcr = gmcr.getGMCRDevice()](sycl::id<1> idx) {
+        const uint32_t data_graph_id = idx[0];
+        // the GMCR lists the query graphs of a data graph in increasing order
+        const uint32_t* paired = gmcr.query_graph_indices + gmcr.data_graph_offsets[data_graph_id];
+        const uint32_t num_paired = gmcr.data_graph_offsets[data_graph_id + 1] - gmcr.data_graph_offsets[data_graph_id];
+        if (num_paired == 0) { return; }
+        const uint32_t start_data_graph = data_graphs.graph_offsets[data_graph_id];
+        const uint32_t end_data_graph = data_graphs.graph_offsets[data_graph_id + 1];
+
+        types::node_t mapping[QueryTrie::MAX_DEPTH];
+        TrieFrame stack[QueryTrie::MAX_DEPTH];
+        size_t private_num_matches = 0;
+        uint top = 0;
+        stack[top++] = {trie.child_offsets[0], trie.child_offsets[1], start_data_graph};
+        while (top > 0) {
+          auto& frame = stack[top - 1];
+          const uint depth = top - 1;
+          if (frame.child == frame.child_end) { // no more siblings: backtrack
+            top--;
+            continue;
+          }
+          const uint32_t node = frame.child;
+          if (frame.next_node == end_data_graph || (frame.next_node == start_data_graph && !trie.hasPairedQuery(node, paired, num_paired))) {
+            frame.child++;
+            frame.next_node = start_data_graph;
+            continue;
+          }
+          const types::node_t candidate = frame.next_node++;
+          if (trie.labels[node] != types::WILDCARD_NODE && trie.labels[node] != data_graphs.node_labels[candidate]) { continue; }
+          bool valid = true;
+          for (uint j = 0; j < depth && valid; j++) {
+            valid = mapping[j] != candidate && (((trie.backward[node] >> j) & 1u) == data_graphs.isNeighbor(mapping[j], candidate));
+          }
+          if (!valid) { continue; }
+          mapping[depth] = candidate;
+
+          for (uint32_t i = trie.terminal_offsets[node]; i < trie.terminal_offsets[node + 1]; i++) {
+            const uint32_t query_graph_id = trie.terminal_queries[i];
+            const uint32_t pos = utils::binarySearch(paired, num_paired, query_graph_id);
+            if (pos == static_cast<uint32_t>(-1) || paired[pos] != query_graph_id) { continue; }
+            private_num_matches++;
+            if (query_matches != nullptr) {
+              sycl::atomic_ref<size_t, sycl::memory_order::relaxed, sycl::memory_scope::device> query_matches_ref{query_matches[query_graph_id]};
+              query_matches_ref++;
+            }
+          }
+          if (trie.child_offsets[node] != trie.child_offsets[node + 1]) {
+            stack[top++] = {trie.child_offsets[node], trie.child_offsets[node + 1], start_data_graph};
+          }
+        }
+
+        sycl::atomic_ref<size_t, sycl::memory_order::relaxed, sycl::memory_scope::device> num_matches_ref{num_matches[0]};
+        if (private_num_matches > 0) num_matches_ref += private_num_matches;
+      });
+
+  e.add(e1);
+  return e;
+}
+
+/**
+ * Check that candidate extends the partial embedding mapping[0..depth) of a query graph: it is not mapped yet and
+ * it is adjacent to the mapped nodes exactly as the query node depth is adjacent to the previous query nodes.
+ */
+SYCL_EXTERNAL inline bool isValidExtension(types::node_t candidate,
+                                           uint depth,
+                                           const types::node_t* mapping,
+                                           const sigmo::DeviceBatchedCSRGraph& query_graphs,
+                                           uint query_graph_id,
+                                           const sigmo::DeviceBatchedCSRGraph& data_graphs) {
+  const size_t query_nodes_offset = query_graphs.getPreviousNodes(query_graph_id);
+  for (uint i = 0; i < depth; i++) {
+    if (mapping[i] == candidate) { return false; }
+    if (query_graphs.isNeighbor(i + query_nodes_offset, depth + query_nodes_offset) != data_graphs.isNeighbor(mapping[i], candidate)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Level-synchronous join for find-all runs: partial embeddings of every GMCR pair are expanded one query node at a time
+ * into device buffers (count, scan, write), so a lane never idles on a single deep search.
+ * When the next level would exceed bfs_frontier_max_bytes the current frontier is completed depth-first instead.
+ * The pairs with a query larger than MAX_QUERY_NODES go to joinCandidates2, those beyond the largest JOIN_DEPTH_CLASSES
+ * are skipped and counted by getOversizedPairs.
+ */
+class BFSJoinEngine {
+public:
+  BFSJoinEngine(sycl::queue& queue) : queue(queue) {}
+
+  template<typename CandidatesT>
+  utils::BatchedEvent run(sigmo::DeviceBatchedCSRGraph& query_graphs,
+                          sigmo::DeviceBatchedCSRGraph& data_graphs,
+                          CandidatesT& candidates,
+                          sigmo::isomorphism::mapping::GMCR& gmcr,
+                          size_t* num_matches,
+                          size_t max_bytes = device::deviceOptions.bfs_frontier_max_bytes) {
+    const size_t total_data_graphs = data_graphs.num_graphs;
+    utils::BatchedEvent ret;
+    levels = 0;
+    peak_frontier = 0;
+    dfs_fallback = false;
+    deep_pairs = 0;
+    oversized_pairs = 0;
+
+    // the frontier buffers hold at most MAX_QUERY_NODES nodes per embedding, deeper queries are joined depth-first
+    std::vector<uint32_t> level_pairs, deep_pair_ids;
+    const auto gmcr_device = gmcr.getGMCRDevice();
+    std::vector<uint32_t> query_indices(gmcr_device.total_query_indices);
+    std::vector<types::row_offset_t> query_offsets(query_graphs.num_graphs + 1);
+    queue.copy(gmcr_device.query_graph_indices, query_indices.data(), query_indices.size()).wait();
+    queue.copy(query_graphs.graph_offsets, query_offsets.data(), query_offsets.size()).wait();
+    for (uint32_t pair_id = 0; pair_id < query_indices.size(); ++pair_id) {
+      const uint32_t query_size = query_offsets[query_indices[pair_id] + 1] - query_offsets[query_indices[pair_id]];
+      if (query_size <= MAX_QUERY_NODES) {
+        level_pairs.push_back(pair_id);
+      } else if (query_size <= DEEP_QUERY_NODES) {
+        deep_pair_ids.push_back(pair_id);
+      } else {
+        oversized_pairs++;
+      }
+    }
+    if (!deep_pair_ids.empty()) {
+      deep_pairs = deep_pair_ids.size();
+      uint32_t* ids = device::memory::malloc<uint32_t>(deep_pair_ids.size(), queue);
+      queue.copy(deep_pair_ids.data(), ids, deep_pair_ids.size()).wait();
+      auto deep_e = joinCandidates2<CandidatesT, DEEP_QUERY_NODES>(
+          queue, query_graphs, data_graphs, candidates, gmcr, num_matches, false, ids, deep_pair_ids.size());
+      deep_e.wait();
+      ret.add(deep_e.getLastEvent());
+      sycl::free(ids, queue);
+    }
+
+    // level 0: one empty embedding per pair
+    size_t frontier_size = level_pairs.size();
+    if (frontier_size == 0) { return ret; }
+    uint32_t* frontier_pairs = device::memory::malloc<uint32_t>(frontier_size, queue);
+    types::node_t* frontier_nodes = nullptr;
+    auto e0 = queue.copy(level_pairs.data(), frontier_pairs, frontier_size);
+    e0.wait();
+    ret.add(e0);
+
+    for (uint32_t level = 0; frontier_size > 0 && level < MAX_QUERY_NODES; ++level) {
+      levels = level + 1;
+      peak_frontier = std::max(peak_frontier, frontier_size);
+
+      // --- Kernel 1: count the valid extensions of every partial embedding, the complete ones are matches ---
+      // the offsets are 64-bit: a match-heavy level can exceed 2^32 children
+      uint64_t* children = device::memory::malloc<uint64_t>(frontier_size + 1, queue);
+      queue.fill(children, uint64_t{0}, 1).wait();
+      auto k1 = queue.parallel_for(
+          sycl::range<1>(frontier_size),
+          [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice(), gmcr = gmcr.getGMCRDevice()](
+              sycl::id<1> idx) {
+            types::node_t mapping[MAX_QUERY_NODES];
+            const uint32_t pair_id = frontier_pairs[idx[0]];
+            const uint32_t query_graph_id = gmcr.query_graph_indices[pair_id];
+            const uint32_t num_query_nodes = query_graphs.getGraphNodes(query_graph_id);
+            const auto slice = getPairSlice(query_graphs, data_graphs, candidates, gmcr, pair_id, total_data_graphs);
+            for (uint32_t i = 0; i < level; i++) { mapping[i] = frontier_nodes[idx[0] * level + i]; }
+
+            uint32_t count = 0;
+            for (uint32_t i = 0; i < slice.getCandidatesCount(level); i++) {
+              count += isValidExtension(slice.getCandidateAt(level, i), level, mapping, query_graphs, query_graph_id, data_graphs);
+            }
+            if (level + 1 == num_query_nodes) {
+              sycl::atomic_ref<size_t, sycl::memory_order::relaxed, sycl::memory_scope::device> num_matches_ref{num_matches[0]};
+              num_matches_ref += count;
+              count = 0;
+            }
+            children[idx[0] + 1] = count;
+          });
+      // --- Kernel 2: children offsets ---
+      auto k2 = device::inclusiveScan(queue, children + 1, frontier_size, k1);
+      uint64_t next_size;
+      queue.copy(children + frontier_size, &next_size, 1, k2).wait();
+      ret.add(k1);
+      ret.add(k2);
+
+      // the current frontier and its offsets stay allocated while the next level is written
+      const size_t current_bytes = frontier_size * (sizeof(uint32_t) + level * sizeof(types::node_t)) + (frontier_size + 1) * sizeof(uint64_t);
+      const size_t embedding_bytes = sizeof(uint32_t) + (level + 1) * sizeof(types::node_t);
+      if (current_bytes > max_bytes || next_size > (max_bytes - current_bytes) / embedding_bytes) {
+        // the next level does not fit: complete the current partial embeddings depth-first
+        dfs_fallback = true;
+        ret.add(completeDepthFirst(query_graphs, data_graphs, candidates, gmcr, num_matches, frontier_pairs, frontier_nodes, frontier_size, level));
+        sycl::free(children, queue);
+        break;
+      }
+
+      // --- Kernel 3: write the extensions of the next level ---
+      uint32_t* next_pairs = device::memory::malloc<uint32_t>(next_size, queue);
+      types::node_t* next_nodes = device::memory::malloc<types::node_t>(next_size * (level + 1), queue);
+      auto k3 = queue.parallel_for(
+          sycl::range<1>(frontier_size),
+          [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice(), gmcr = gmcr.getGMCRDevice()](
+              sycl::id<1> idx) {
+            uint64_t offset = children[idx[0]];
+            if (offset == children[idx[0] + 1]) { return; }
+            types::node_t mapping[MAX_QUERY_NODES];
+            const uint32_t pair_id = frontier_pairs[idx[0]];
+            const uint32_t query_graph_id = gmcr.query_graph_indices[pair_id];
+            const auto slice = getPairSlice(query_graphs, data_graphs, candidates, gmcr, pair_id, total_data_graphs);
+            for (uint32_t i = 0; i < level; i++) { mapping[i] = frontier_nodes[idx[0] * level + i]; }
+
+            for (uint32_t i = 0; i < slice.getCandidatesCount(level); i++) {
+              const types::node_t candidate = slice.getCandidateAt(level, i);
+              if (!isValidExtension(candidate, level, mapping, query_graphs, query_graph_id, data_graphs)) { continue; }
+              next_pairs[offset] = pair_id;
+              for (uint32_t j = 0; j < level; j++) { next_nodes[offset * (level + 1) + j] = mapping[j]; }
+              next_nodes[offset * (level + 1) + level] = candidate;
+              offset++;
+            }
+          });
+      k3.wait();
+      ret.add(k3);
+
+      sycl::free(children, queue);
+      sycl::free(frontier_pairs, queue);
+      if (frontier_nodes != nullptr) sycl::free(frontier_nodes, queue);
+      frontier_pairs = next_pairs;
+      frontier_nodes = next_nodes;
+      frontier_size = next_size;
+    }
+
+    sycl::free(frontier_pairs, queue);
+    if (frontier_nodes != nullptr) sycl::free(frontier_nodes, queue);
+    // every embedding left is complete after MAX_QUERY_NODES levels, a frontier still alive is a bug
+    if (frontier_size > 0 && !dfs_fallback) { throw std::runtime_error("BFSJoinEngine: the frontier outlived the deepest query"); }
+    return ret;
+  }
+
+  uint32_t getLevels() const { return levels; }
+  size_t getPeakFrontier() const { return peak_frontier; }
+  bool usedDepthFirst() const { return dfs_fallback; }
+  size_t getDeepPairs() const { return deep_pairs; }
+  size_t getOversizedPairs() const { return oversized_pairs; }
+
+  static constexpr uint32_t MAX_QUERY_NODES = 30;
+  static constexpr size_t DEEP_QUERY_NODES = std::end(JOIN_DEPTH_CLASSES)[-1];
+
+private:
+  sycl::queue& queue;
+  uint32_t levels = 0;
+  size_t peak_frontier = 0;
+  bool dfs_fallback = false;
+  size_t deep_pairs = 0;
+  size_t oversized_pairs = 0;
+
+  template<typename CandidatesDeviceT, typename GMCRDeviceT>
+  SYCL_EXTERNAL static auto getPairSlice(const sigmo::DeviceBatchedCSRGraph& query_graphs,
+                                         const sigmo::DeviceBatchedCSRGraph& data_graphs,
+                                         const CandidatesDeviceT& candidates,
+                                         const GMCRDeviceT& gmcr,
+                                         uint32_t pair_id,
+                                         size_t total_data_graphs) {
+    const uint32_t query_graph_id = gmcr.query_graph_indices[pair_id];
+    const uint32_t data_graph_id = utils::binarySearch(gmcr.data_graph_offsets, total_data_graphs, pair_id);
+    return sigmo::candidates::getSlice(candidates,
+                                       pair_id,
+                                       query_graphs.getPreviousNodes(query_graph_id),
+                                       data_graph_id,
+                                       data_graphs.graph_offsets[data_graph_id],
+                                       data_graphs.graph_offsets[data_graph_id + 1]);
+  }
+
+  /**
+   * Finish every partial embedding of the frontier with a depth-first search, one work-item each.
+   */
+  template<typename CandidatesT>
+  sycl::event completeDepthFirst(sigmo::DeviceBatchedCSRGraph& query_graphs,
+                                 sigmo::DeviceBatchedCSRGraph& data_graphs,
+                                 CandidatesT& candidates,
+                                 sigmo::isomorphism::mapping::GMCR& gmcr,
+                                 size_t* num_matches,
+                                 const uint32_t* frontier_pairs,
+                                 const types::node_t* frontier_nodes,
+                                 size_t frontier_size,
+                                 uint32_t level) {
+    const size_t total_data_graphs = data_graphs.num_graphs;
+    auto e = queue.parallel_for(
+        sycl::range<1>(frontier_size),
+        [=, query_graphs = query_graphs, data_graphs = data_graphs, candidates = candidates.getCandidatesDevice(), gmcr = gmcr.getGMCRDevice()](
+            sycl::id<1> idx) {
+          types::node_t mapping[MAX_QUERY_NODES];
+          Stack stack[MAX_QUERY_NODES];
+          const uint32_t pair_id = frontier_pairs[idx[0]];
+          const uint32_t query_graph_id = gmcr.query_graph_indices[pair_id];
+          const uint32_t num_query_nodes = query_graphs.getGraphNodes(query_graph_id);
+          const auto slice = getPairSlice(query_graphs, data_graphs, candidates, gmcr, pair_id, total_data_graphs);
+          for (uint32_t i = 0; i < level; i++) { mapping[i] = frontier_nodes[idx[0] * level + i]; }
+
+          size_t private_num_matches = 0;
+          uint top = 0;
+          stack[top++] = {level, 0};
+          while (top > 0) {
+            auto& frame = stack[top - 1];
+            if (frame.candidateIdx >= slice.getCandidatesCount(frame.depth)) {
+              top--;
+              continue;
+            }
+            const types::node_t candidate = slice.getCandidateAt(frame.depth, frame.candidateIdx++);
+            if (!isValidExtension(candidate, frame.depth, mapping, query_graphs, query_graph_id, data_graphs)) { continue; }
+            mapping[frame.depth] = candidate;
+            if (frame.depth + 1 == num_query_nodes) {
+              private_num_matches++;
+            } else {
+              stack[top++] = {frame.depth + 1, 0};
+            }
+          }
+
+          sycl::atomic_ref<size_t, sycl::memory_order::relaxed, sycl::memory_scope::device> num_matches_ref{num_matches[0]};
+          num_matches_ref += private_num_matches;
+        });
+    e.wait();
+    return e;
+  }
+};
+
 } // namespace join
 } // namespace isomorphism
 } // namespace sigmo
\ No newline at end of file
@@ -7,11 +7,14 @@
 
 #include "candidates.hpp"
 #include "device.hpp"
+#include "engine.hpp"
 #include "gmcr.hpp"
 #include "graph.hpp"
+#include "host.hpp"
 #include "io.hpp"
 #include "isomorphism.hpp"
 #include "pool.hpp"
 #include "signature.hpp"
+#include "trie.hpp"
 #include "types.hpp"
 #include "utils.hpp"
\ No newline at end of file
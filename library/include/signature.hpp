@@ -9,6 +9,7 @@
 #include "types.hpp"
 #include "utils.hpp"
 #include <cstdint>
+#include <stdexcept>
 #include <sycl/sycl.hpp>
 
 namespace sigmo {
@@ -51,45 +52,50 @@ public:
     }
 
     SYCL_EXTERNAL void clear() { signature = 0; }
+
+    /**
+     * Check if every label count of this signature is >= the one of `other` (i.e. `other` may map onto this node).
+     */
+    SYCL_EXTERNAL bool dominates(const SignatureDevice& other) const { return utils::swar::dominates<uint64_t, Bits>(signature, other.signature); }
   };
 
   template<typename T>
-  utils::BatchedEvent generateQuerySignatures(T& graphs) {
-    return generateSignatures(graphs, SignatureScope::Query);
+  utils::BatchedEvent generateQuerySignatures(T& graphs, const std::vector<sycl::event>& depends = {}) {
+    return generateSignatures(graphs, SignatureScope::Query, depends);
   }
 
   template<typename T>
-  utils::BatchedEvent refineQuerySignatures(T& graphs, size_t view_size = 1) {
-    return refineSignatures(graphs, view_size, SignatureScope::Query);
+  utils::BatchedEvent refineQuerySignatures(T& graphs, size_t view_size = 1, const std::vector<sycl::event>& depends = {}) {
+    return refineSignatures(graphs, view_size, SignatureScope::Query, depends);
   }
 
   template<typename T>
-  utils::BatchedEvent generateDataSignatures(T& graphs) {
-    return generateSignatures(graphs, SignatureScope::Data);
+  utils::BatchedEvent generateDataSignatures(T& graphs, const std::vector<sycl::event>& depends = {}) {
+    return generateSignatures(graphs, SignatureScope::Data, depends);
   }
 
   template<typename T>
-  utils::BatchedEvent refineDataSignatures(T& graphs, size_t view_size = 1) {
-    return refineSignatures(graphs, view_size, SignatureScope::Data);
+  utils::BatchedEvent refineDataSignatures(T& graphs, size_t view_size = 1, const std::vector<sycl::event>& depends = {}) {
+    return refineSignatures(graphs, view_size, SignatureScope::Data, depends);
   }
 
   template<typename T>
-  utils::BatchedEvent generateSignatures(T& graphs, SignatureScope s) {
+  utils::BatchedEvent generateSignatures(T& graphs, SignatureScope s, const std::vector<sycl::event>& depends = {}) {
     if constexpr (std::is_same_v<std::decay_t<T>, DeviceBatchedAMGraph>) {
-      return generateAMSignatures(graphs, s);
+      return generateAMSignatures(graphs, s, depends);
     } else if constexpr (std::is_same_v<std::decay_t<T>, DeviceBatchedCSRGraph>) {
-      return generateCSRSignatures(graphs, s);
+      return generateCSRSignatures(graphs, s, depends);
     } else {
       throw std::runtime_error("Unsupported graph type");
     }
   }
 
   template<typename T>
-  utils::BatchedEvent refineSignatures(T& graphs, size_t view_size, SignatureScope s) {
+  utils::BatchedEvent refineSignatures(T& graphs, size_t view_size, SignatureScope s, const std::vector<sycl::event>& depends = {}) {
     if constexpr (std::is_same_v<std::decay_t<T>, DeviceBatchedAMGraph>) {
-      return refineAMSignatures(graphs, view_size, s);
+      return refineAMSignatures(graphs, view_size, s, depends);
     } else if constexpr (std::is_same_v<std::decay_t<T>, DeviceBatchedCSRGraph>) {
-      return refineCSRSignatures(graphs, view_size, s);
+      return refineCSRSignatures(graphs, view_size, s, depends);
     } else {
       throw std::runtime_error("Unsupported graph type");
     }
@@ -97,11 +103,12 @@ public:
 
 
   // TODO consider to use the shared memory to store the graph to avoid uncoallesced memory access
-  utils::BatchedEvent generateAMSignatures(DeviceBatchedAMGraph& graphs, SignatureScope s) {
+  utils::BatchedEvent generateAMSignatures(DeviceBatchedAMGraph& graphs, SignatureScope s, const std::vector<sycl::event>& depends = {}) {
     utils::BatchedEvent event;
     sycl::range<1> global_range(graphs.total_nodes);
     SignatureDevice* signatures = s == SignatureScope::Data ? data_signatures : query_signatures;
-    auto e = queue.submit([&](sycl::handler& cgh) {
+    auto e = getQueue(s).submit([&](sycl::handler& cgh) {
+      cgh.depends_on(depends);
       cgh.parallel_for<sigmo::device::kernels::GenerateQuerySignaturesKernel>(
           sycl::range<1>{graphs.total_nodes}, [=, graphs = graphs](sycl::item<1> item) {
             auto node_id = item.get_id(0);
@@ -120,14 +127,18 @@ public:
   }
 
   template<Algorithm _A = A>
-  utils::BatchedEvent refineAMSignatures(DeviceBatchedAMGraph& graphs, size_t view_size, SignatureScope s);
+  utils::BatchedEvent refineAMSignatures(DeviceBatchedAMGraph& graphs,
+                                         size_t view_size,
+                                         SignatureScope s,
+                                         const std::vector<sycl::event>& depends = {});
 
-  utils::BatchedEvent generateCSRSignatures(DeviceBatchedCSRGraph& graphs, SignatureScope s) {
+  utils::BatchedEvent generateCSRSignatures(DeviceBatchedCSRGraph& graphs, SignatureScope s, const std::vector<sycl::event>& depends = {}) {
     utils::BatchedEvent event;
     sycl::range<1> global_range(graphs.total_nodes);
     SignatureDevice* signatures = s == SignatureScope::Data ? data_signatures : query_signatures;
 
-    auto e = queue.submit([&](sycl::handler& cgh) {
+    auto e = getQueue(s).submit([&](sycl::handler& cgh) {
+      cgh.depends_on(depends);
       auto* row_offsets = graphs.row_offsets;
       auto* column_indices = graphs.column_indices;
       auto* node_labels = graphs.node_labels;
@@ -152,26 +163,47 @@ public:
   }
 
   template<Algorithm _A = A>
-  utils::BatchedEvent refineCSRSignatures(DeviceBatchedCSRGraph& graphs, size_t view_size, SignatureScope s);
-
-  Signature(sycl::queue& queue, size_t data_nodes, size_t query_nodes) : queue(queue), data_nodes(data_nodes), query_nodes(query_nodes) {
+  utils::BatchedEvent refineCSRSignatures(DeviceBatchedCSRGraph& graphs,
+                                          size_t view_size,
+                                          SignatureScope s,
+                                          const std::vector<sycl::event>& depends = {});
+
+  Signature(sycl::queue& queue, size_t data_nodes, size_t query_nodes) : Signature(queue, queue, data_nodes, query_nodes) {}
+
+  /**
+   * Submit the data and the query signatures on their own queues, so the two scopes overlap until the filter joins them.
+   * The queues must share the context and the device, the buffers of both scopes are allocated on data_queue.
+   */
+  Signature(sycl::queue& data_queue, sycl::queue& query_queue, size_t data_nodes, size_t query_nodes)
+      : queue(data_queue), query_queue(query_queue), data_nodes(data_nodes), query_nodes(query_nodes) {
+    if (data_queue.get_context() != query_queue.get_context() || data_queue.get_device() != query_queue.get_device()) {
+      throw std::runtime_error("The data and query signature queues must share the context and the device");
+    }
     data_signatures = device::memory::malloc<SignatureDevice>(data_nodes, queue);
     query_signatures = device::memory::malloc<SignatureDevice>(query_nodes, queue);
     if constexpr (A == Algorithm::ViewBased) {
-      tmp_buff = device::memory::malloc<SignatureDevice>(std::max(data_nodes, query_nodes), queue);
+      // one staging buffer per scope, the two scopes may be refined at the same time
+      data_tmp_buff = device::memory::malloc<SignatureDevice>(data_nodes, queue);
+      query_tmp_buff = device::memory::malloc<SignatureDevice>(query_nodes, queue);
     } else if constexpr (A == Algorithm::PowerGraph) {
       data_reachables = device::memory::malloc<utils::detail::Bitset<uint64_t>>(data_nodes, queue);
       query_reachables = device::memory::malloc<utils::detail::Bitset<uint64_t>>(query_nodes, queue);
     }
     queue.fill(data_signatures, 0, data_nodes).wait();
     queue.fill(query_signatures, 0, query_nodes).wait();
+    if constexpr (A == Algorithm::PowerGraph) {
+      // the first refinement step subtracts the nodes reached before it, i.e. none
+      queue.fill(data_reachables, utils::detail::Bitset<uint64_t>{}, data_nodes).wait();
+      queue.fill(query_reachables, utils::detail::Bitset<uint64_t>{}, query_nodes).wait();
+    }
   }
 
   ~Signature() {
     sycl::free(data_signatures, queue);
     sycl::free(query_signatures, queue);
     if constexpr (A == Algorithm::ViewBased) {
-      sycl::free(tmp_buff, queue);
+      sycl::free(data_tmp_buff, queue);
+      sycl::free(query_tmp_buff, queue);
     } else if constexpr (A == Algorithm::PowerGraph) {
       sycl::free(data_reachables, queue);
       sycl::free(query_reachables, queue);
@@ -196,38 +228,78 @@ public:
     }
     return alloc;
   }
+  /**
+   * Prepare the query side for a new batch of query_nodes nodes, growing the buffers when needed.
+   * The data side is left untouched, so the data signatures can stay resident across batches.
+   */
+  void resetQuerySignatures(size_t query_nodes) {
+    if (query_nodes > this->query_nodes) {
+      sycl::free(query_signatures, queue);
+      query_signatures = device::memory::malloc<SignatureDevice>(query_nodes, queue);
+      if constexpr (A == Algorithm::ViewBased) {
+        sycl::free(query_tmp_buff, queue);
+        query_tmp_buff = device::memory::malloc<SignatureDevice>(query_nodes, queue);
+      } else if constexpr (A == Algorithm::PowerGraph) {
+        sycl::free(query_reachables, queue);
+        query_reachables = device::memory::malloc<utils::detail::Bitset<uint64_t>>(query_nodes, queue);
+      }
+      this->query_nodes = query_nodes;
+    }
+    query_queue.fill(query_signatures, SignatureDevice{}, query_nodes).wait();
+    if constexpr (A == Algorithm::PowerGraph) { query_queue.fill(query_reachables, utils::detail::Bitset<uint64_t>{}, query_nodes).wait(); }
+  }
+
+  /**
+   * Copy the data signatures to or from a snapshot of data_nodes entries, e.g. one per refinement level.
+   */
+  sycl::event storeDataSignatures(SignatureDevice* snapshot, const std::vector<sycl::event>& depends = {}) {
+    return queue.copy(data_signatures, snapshot, data_nodes, depends);
+  }
+  sycl::event loadDataSignatures(const SignatureDevice* snapshot, const std::vector<sycl::event>& depends = {}) {
+    return queue.copy(snapshot, data_signatures, data_nodes, depends);
+  }
+
+  sycl::queue& getQueue(SignatureScope s) { return s == SignatureScope::Data ? queue : query_queue; }
   SignatureDevice* getDeviceDataSignatures() const { return data_signatures; }
   SignatureDevice* getDeviceQuerySignatures() const { return query_signatures; }
   size_t getMaxLabels() const { return SignatureDevice::getMaxLabels(); }
 
 private:
-  sycl::queue& queue;
+  sycl::queue& queue; // data scope and allocations
+  sycl::queue& query_queue;
   size_t data_nodes;
   size_t query_nodes;
   SignatureDevice* data_signatures;
   SignatureDevice* query_signatures;
-  SignatureDevice* tmp_buff;
+  SignatureDevice* data_tmp_buff = nullptr;
+  SignatureDevice* query_tmp_buff = nullptr;
   utils::detail::Bitset<uint64_t>* data_reachables;
   utils::detail::Bitset<uint64_t>* query_reachables;
 
+  SignatureDevice* getTmpBuffer(SignatureScope s) const { return s == SignatureScope::Data ? data_tmp_buff : query_tmp_buff; }
+
   template<>
-  utils::BatchedEvent refineAMSignatures<Algorithm::ViewBased>(DeviceBatchedAMGraph& graphs, size_t view_size, SignatureScope s) {
+  utils::BatchedEvent refineAMSignatures<Algorithm::ViewBased>(DeviceBatchedAMGraph& graphs,
+                                                               size_t view_size,
+                                                               SignatureScope s,
+                                                               const std::vector<sycl::event>& depends) {
     utils::BatchedEvent event;
     sycl::range<1> global_range(graphs.total_nodes);
 
     auto signatures = s == SignatureScope::Data ? data_signatures : query_signatures;
-    auto copy_event = queue.submit([&](sycl::handler& cgh) {
-      cgh.parallel_for(sycl::range<1>(graphs.total_nodes), [=, tmp_buff = this->tmp_buff](sycl::item<1> item) { tmp_buff[item] = signatures[item]; });
+    auto tmp_buff = getTmpBuffer(s);
+    auto copy_event = getQueue(s).submit([&](sycl::handler& cgh) {
+      cgh.depends_on(depends);
+      cgh.parallel_for(sycl::range<1>(graphs.total_nodes), [=](sycl::item<1> item) { tmp_buff[item] = signatures[item]; });
     });
     event.add(copy_event);
-    copy_event.wait();
 
-    auto refinement_event = queue.submit([&](sycl::handler& cgh) {
+    auto refinement_event = getQueue(s).submit([&](sycl::handler& cgh) {
       cgh.depends_on(copy_event);
       const uint16_t max_labels_count = Signature::SignatureDevice::getMaxLabels();
 
       cgh.parallel_for<sigmo::device::kernels::RefineQuerySignaturesKernel>(
-          sycl::range<1>{graphs.total_nodes}, [=, graphs = graphs, tmp_buff = this->tmp_buff](sycl::item<1> item) {
+          sycl::range<1>{graphs.total_nodes}, [=, graphs = graphs](sycl::item<1> item) {
             auto node_id = item.get_id(0);
             // Get the neighbors of the current node
             types::node_t neighbors[types::MAX_NEIGHBORS];
@@ -248,15 +320,19 @@ private:
   }
 
   template<>
-  utils::BatchedEvent refineAMSignatures<Algorithm::PowerGraph>(DeviceBatchedAMGraph& graphs, size_t view_size, SignatureScope s) {
+  utils::BatchedEvent refineAMSignatures<Algorithm::PowerGraph>(DeviceBatchedAMGraph& graphs,
+                                                                size_t view_size,
+                                                                SignatureScope s,
+                                                                const std::vector<sycl::event>& depends) {
     utils::BatchedEvent event;
     sycl::range<1> global_range(graphs.total_nodes);
     const uint16_t max_labels_count = Signature::SignatureDevice::getMaxLabels();
     auto signatures = s == SignatureScope::Data ? data_signatures : query_signatures;
 
-    auto refinement_event = queue.submit([&](sycl::handler& cgh) {
+    auto refinement_event = getQueue(s).submit([&](sycl::handler& cgh) {
+      cgh.depends_on(depends);
       cgh.parallel_for<sigmo::device::kernels::RefineQuerySignaturesKernel>(
-          sycl::range<1>{graphs.total_nodes}, [=, graphs = graphs, tmp_buff = this->tmp_buff](sycl::item<1> item) {
+          sycl::range<1>{graphs.total_nodes}, [=, graphs = graphs, tmp_buff = getTmpBuffer(s)](sycl::item<1> item) {
             auto node_id = item.get_id(0);
             auto graph_id = graphs.getGraphId(node_id);
             auto prev_nodes = graphs.getPreviousNodes(graph_id);
@@ -296,17 +372,21 @@ private:
   }
 
   template<>
-  utils::BatchedEvent refineCSRSignatures<Algorithm::ViewBased>(DeviceBatchedCSRGraph& graphs, size_t view_size, SignatureScope s) {
+  utils::BatchedEvent refineCSRSignatures<Algorithm::ViewBased>(DeviceBatchedCSRGraph& graphs,
+                                                                size_t view_size,
+                                                                SignatureScope s,
+                                                                const std::vector<sycl::event>& depends) {
     utils::BatchedEvent event;
     sycl::range<1> global_range(graphs.total_nodes);
     auto signatures = s == SignatureScope::Data ? data_signatures : query_signatures;
-    auto tmp_buff = this->tmp_buff;
+    auto tmp_buff = getTmpBuffer(s);
 
-    auto copy_event = queue.submit([&](sycl::handler& cgh) {
+    auto copy_event = getQueue(s).submit([&](sycl::handler& cgh) {
+      cgh.depends_on(depends);
       cgh.parallel_for(sycl::range<1>(graphs.total_nodes), [=](sycl::item<1> item) { tmp_buff[item] = signatures[item]; });
     });
     event.add(copy_event);
-    auto refine_event = queue.submit([&](sycl::handler& cgh) {
+    auto refine_event = getQueue(s).submit([&](sycl::handler& cgh) {
       cgh.depends_on(copy_event);
       auto* row_offsets = graphs.row_offsets;
       auto* column_indices = graphs.column_indices;
@@ -334,13 +414,17 @@ private:
   }
 
   template<>
-  utils::BatchedEvent refineCSRSignatures<Algorithm::PowerGraph>(DeviceBatchedCSRGraph& graphs, size_t view_size, SignatureScope s) {
+  utils::BatchedEvent refineCSRSignatures<Algorithm::PowerGraph>(DeviceBatchedCSRGraph& graphs,
+                                                                 size_t view_size,
+                                                                 SignatureScope s,
+                                                                 const std::vector<sycl::event>& depends) {
     utils::BatchedEvent event;
     sycl::range<1> global_range(graphs.total_nodes);
     auto signatures = s == SignatureScope::Data ? data_signatures : query_signatures;
     auto old_reachables = s == SignatureScope::Data ? data_reachables : query_reachables;
 
-    auto refine_event = queue.submit([&](sycl::handler& cgh) {
+    auto refine_event = getQueue(s).submit([&](sycl::handler& cgh) {
+      cgh.depends_on(depends);
       auto* row_offsets = graphs.row_offsets;
       auto* column_indices = graphs.column_indices;
       auto* node_labels = graphs.node_labels;
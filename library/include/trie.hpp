@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2025 University of Salerno
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "device.hpp"
+#include "graph.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <map>
+#include <sycl/sycl.hpp>
+#include <utility>
+#include <vector>
+
+namespace sigmo {
+namespace isomorphism {
+namespace trie {
+
+/**
+ * Trie of the query graphs under the matching order of the join (the node order): two queries share the trie node at
+ * depth d when their first d + 1 nodes carry the same labels and the same adjacency among them.
+ * Node 0 is the root and the children of every node are contiguous.
+ */
+class QueryTrie {
+public:
+  static constexpr size_t MAX_DEPTH = 32; // the backward adjacency of a node is a 32-bit mask
+
+  struct QueryTrieDevice {
+    uint32_t* child_offsets; // children of node t are [child_offsets[t], child_offsets[t + 1])
+    types::label_t* labels;
+    uint32_t* backward; // bit j set when the query node at depth j is adjacent to the node
+    uint32_t* terminal_offsets;
+    uint32_t* terminal_queries; // queries whose last node is the trie node
+    uint32_t* pass_offsets;
+    uint32_t* pass_queries; // queries through the trie node, sorted
+    uint32_t num_nodes;
+
+    /**
+     * Check if a query through node is among the sorted paired query graphs, a merge of the two sorted lists.
+     */
+    SYCL_EXTERNAL bool hasPairedQuery(uint32_t node, const uint32_t* paired, uint32_t num_paired) const {
+      uint32_t i = pass_offsets[node], j = 0;
+      while (i < pass_offsets[node + 1] && j < num_paired) {
+        if (pass_queries[i] == paired[j]) { return true; }
+        if (pass_queries[i] < paired[j]) {
+          i++;
+        } else {
+          j++;
+        }
+      }
+      return false;
+    }
+  };
+
+  QueryTrie(sycl::queue& queue, const sigmo::DeviceBatchedCSRGraph& query_graphs) : queue(queue) {
+    std::vector<types::row_offset_t> graph_offsets(query_graphs.num_graphs + 1);
+    std::vector<types::row_offset_t> row_offsets(query_graphs.total_nodes + 1);
+    std::vector<types::col_index_t> column_indices(query_graphs.total_edges);
+    std::vector<types::label_t> node_labels(query_graphs.total_nodes);
+    queue.copy(query_graphs.graph_offsets, graph_offsets.data(), graph_offsets.size());
+    queue.copy(query_graphs.row_offsets, row_offsets.data(), row_offsets.size());
+    queue.copy(query_graphs.column_indices, column_indices.data(), column_indices.size());
+    queue.copy(query_graphs.node_labels, node_labels.data(), node_labels.size());
+    queue.wait_and_throw();
+
+    std::vector<HostNode> nodes(1);
+    for (uint32_t query_graph_id = 0; query_graph_id < query_graphs.num_graphs; ++query_graph_id) {
+      const uint32_t first_node = graph_offsets[query_graph_id];
+      const uint32_t num_nodes = graph_offsets[query_graph_id + 1] - first_node;
+      if (num_nodes == 0 || num_nodes > MAX_DEPTH) {
+        skipped_queries++;
+        continue;
+      }
+      uint32_t current = 0;
+      for (uint32_t u = 0; u < num_nodes; ++u) {
+        uint32_t backward = 0;
+        for (auto e = row_offsets[first_node + u]; e < row_offsets[first_node + u + 1]; ++e) {
+          const uint32_t v = column_indices[e] - first_node;
+          if (v < u) { backward |= 1u << v; }
+        }
+        const auto key = std::make_pair(node_labels[first_node + u], backward);
+        auto it = nodes[current].children.find(key);
+        if (it != nodes[current].children.end()) {
+          current = it->second;
+        } else {
+          nodes[current].children.emplace(key, static_cast<uint32_t>(nodes.size()));
+          current = nodes.size();
+          nodes.push_back(HostNode{key.first, key.second});
+        }
+        nodes[current].pass.push_back(query_graph_id);
+      }
+      nodes[current].terminal.push_back(query_graph_id);
+      indexed_query_nodes += num_nodes;
+    }
+    flatten(nodes);
+  }
+
+  ~QueryTrie() {
+    sycl::free(trie.child_offsets, queue);
+    sycl::free(trie.labels, queue);
+    sycl::free(trie.backward, queue);
+    sycl::free(trie.terminal_offsets, queue);
+    sycl::free(trie.terminal_queries, queue);
+    sycl::free(trie.pass_offsets, queue);
+    sycl::free(trie.pass_queries, queue);
+  }
+
+  QueryTrieDevice getQueryTrieDevice() const { return trie; }
+
+  /**
+   * Trie nodes without the root, against getNumIndexedQueryNodes() when every query is kept apart.
+   */
+  size_t getNumNodes() const { return trie.num_nodes - 1; }
+  size_t getNumIndexedQueryNodes() const { return indexed_query_nodes; }
+  size_t getSkippedQueries() const { return skipped_queries; }
+
+  size_t getAllocationSize() const {
+    return (trie.num_nodes + 1) * 3 * sizeof(uint32_t) + trie.num_nodes * (sizeof(types::label_t) + sizeof(uint32_t))
+           + (indexed_query_nodes + terminal_queries) * sizeof(uint32_t);
+  }
+
+private:
+  struct HostNode {
+    types::label_t label = 0;
+    uint32_t backward = 0;
+    std::map<std::pair<types::label_t, uint32_t>, uint32_t> children;
+    std::vector<uint32_t> terminal;
+    std::vector<uint32_t> pass;
+  };
+
+  sycl::queue& queue;
+  QueryTrieDevice trie{};
+  size_t indexed_query_nodes = 0;
+  size_t terminal_queries = 0;
+  size_t skipped_queries = 0;
+
+  /**
+   * Number the nodes in breadth-first order, so that siblings are contiguous, and upload them.
+   */
+  void flatten(const std::vector<HostNode>& nodes) {
+    std::vector<uint32_t> order{0};
+    for (size_t i = 0; i < order.size(); ++i) {
+      for (auto& [key, child] : nodes[order[i]].children) { order.push_back(child); }
+    }
+
+    const size_t num_nodes = order.size();
+    std::vector<uint32_t> child_offsets(num_nodes + 1), terminal_offsets(num_nodes + 1), pass_offsets(num_nodes + 1);
+    std::vector<types::label_t> labels(num_nodes);
+    std::vector<uint32_t> backward(num_nodes), terminal, pass;
+    uint32_t next_child = 1;
+    for (size_t i = 0; i < num_nodes; ++i) {
+      const auto& node = nodes[order[i]];
+      child_offsets[i] = next_child;
+      next_child += node.children.size();
+      labels[i] = node.label;
+      backward[i] = node.backward;
+      terminal.insert(terminal.end(), node.terminal.begin(), node.terminal.end());
+      pass.insert(pass.end(), node.pass.begin(), node.pass.end());
+      terminal_offsets[i + 1] = terminal.size();
+      pass_offsets[i + 1] = pass.size();
+    }
+    child_offsets[num_nodes] = next_child;
+    terminal_queries = terminal.size();
+
+    trie.num_nodes = num_nodes;
+    trie.child_offsets = upload(child_offsets);
+    trie.labels = upload(labels);
+    trie.backward = upload(backward);
+    trie.terminal_offsets = upload(terminal_offsets);
+    trie.terminal_queries = upload(terminal);
+    trie.pass_offsets = upload(pass_offsets);
+    trie.pass_queries = upload(pass);
+    queue.wait_and_throw();
+  }
+
+  template<typename T>
+  T* upload(const std::vector<T>& values) {
+    T* ptr = device::memory::malloc<T>(std::max<size_t>(values.size(), 1), queue);
+    if (!values.empty()) queue.copy(values.data(), ptr, values.size());
+    return ptr;
+  }
+};
+
+} // namespace trie
+} // namespace isomorphism
+} // namespace sigmo
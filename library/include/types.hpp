@@ -6,6 +6,7 @@
 #pragma once
 
 #include <cstdint>
+#include <iterator>
 #include <limits>
 
 namespace sigmo {
@@ -27,6 +28,14 @@ constexpr node_t NULL_NODE = std::numeric_limits<node_t>::max();
 
 constexpr std::size_t MAX_NEIGHBORS = 4;
 
+// query sizes the per-pair join kernels are instantiated for: each pair runs in the smallest class holding its query
+inline constexpr std::size_t JOIN_DEPTH_CLASSES[] = {8, 16, 32, 64};
+
+// largest graphs the device kernels take: a data graph fits the Bitset<uint64_t> of the visited and reachable nodes,
+// a query graph the largest per-pair join kernel
+constexpr std::size_t MAX_DEVICE_DATA_NODES = 64;
+constexpr std::size_t MAX_DEVICE_QUERY_NODES = std::end(JOIN_DEPTH_CLASSES)[-1];
+
 
 } // namespace types
 } // namespace sigmo
\ No newline at end of file
@@ -8,7 +8,10 @@
 #include "types.hpp"
 #include <chrono>
 #include <cmath>
+#include <initializer_list>
+#include <string>
 #include <sycl/sycl.hpp>
+#include <type_traits>
 #include <vector>
 
 namespace sigmo {
@@ -97,6 +100,53 @@ struct Bitset {
 
 } // namespace detail
 
+namespace swar {
+
+/**
+ * Mask with the lowest bit of every other Bits-wide field set (fields 0, 2, 4, ...).
+ * Used as the guard bits of the borrow test, placed in the (cleared) odd fields.
+ */
+template<typename TypeT, size_t Bits>
+constexpr TypeT getEvenFieldsLowBits() {
+  TypeT mask = 0;
+  for (size_t i = 0; i < sizeof(TypeT) * 8; i += 2 * Bits) { mask |= static_cast<TypeT>(1) << i; }
+  return mask;
+}
+
+template<typename TypeT, size_t Bits>
+constexpr TypeT getEvenFieldsMask() {
+  return getEvenFieldsLowBits<TypeT, Bits>() * ((static_cast<TypeT>(1) << Bits) - 1);
+}
+
+/**
+ * Branch-free check that every Bits-wide unsigned field of `big` is >= the matching field of `small`.
+ * Fields are split in even and odd halves so that each field has a free guard bit right above it:
+ * the guard is set in `big`, the subtraction borrows it away only when small > big for that field.
+ */
+template<typename TypeT, size_t Bits>
+SYCL_EXTERNAL inline bool dominates(TypeT big, TypeT small) {
+  static_assert(std::is_unsigned_v<TypeT>, "SWAR fields must be stored in an unsigned word");
+  static_assert((sizeof(TypeT) * 8) % (2 * Bits) == 0, "Bits must split the word in an even number of fields");
+  constexpr TypeT fields = getEvenFieldsMask<TypeT, Bits>();
+  constexpr TypeT guards = getEvenFieldsLowBits<TypeT, Bits>() << Bits;
+
+  TypeT even = (((big & fields) | guards) - (small & fields)) & guards;
+  TypeT odd = ((((big >> Bits) & fields) | guards) - ((small >> Bits) & fields)) & guards;
+  return (even & odd) == guards;
+}
+
+/**
+ * Multi-word variant for signatures wider than a single machine word.
+ */
+template<typename TypeT, size_t Bits, size_t N>
+SYCL_EXTERNAL inline bool dominates(const TypeT (&big)[N], const TypeT (&small)[N]) {
+  bool ret = true;
+  for (size_t i = 0; i < N; ++i) { ret &= dominates<TypeT, Bits>(big[i], small[i]); }
+  return ret;
+}
+
+} // namespace swar
+
 SYCL_EXTERNAL uint32_t binaryAMSearch(const uint32_t* num_nodes, uint32_t total_graphs, uint32_t node_id) {
   uint32_t low = 0;
   uint32_t high = total_graphs - 1;
@@ -127,6 +177,7 @@ SYCL_EXTERNAL uint32_t binarySearch(const uint32_t* vector, uint32_t size, uint3
 class BatchedEvent {
 public:
   BatchedEvent() = default;
+  explicit BatchedEvent(sycl::event e) { add(e); }
 
   void add(sycl::event e) { events.push_back(e); }
 
@@ -146,6 +197,8 @@ public:
 
   size_t numEvents() { return events.size(); }
 
+  const std::vector<sycl::event>& getEvents() const { return events; }
+
   std::chrono::duration<double> getProfilingInfo() {
     std::chrono::nanoseconds total_time(0);
     for (auto& e : events) {
@@ -160,5 +213,57 @@ private:
   std::vector<sycl::event> events;
 };
 
+/**
+ * Pipeline stages submitted without host synchronization: every stage is submitted after the events of the stages it
+ * reads from, the host waits once for the whole graph and then reads the device time of every stage.
+ */
+class StageGraph {
+public:
+  using StageId = size_t;
+
+  StageId add(std::string name, BatchedEvent events) {
+    stages.push_back(Stage{std::move(name), std::move(events)});
+    return stages.size() - 1;
+  }
+
+  /**
+   * Events a new stage has to wait for, to be passed as its dependency list.
+   */
+  std::vector<sycl::event> after(std::initializer_list<StageId> ids) const {
+    std::vector<sycl::event> depends;
+    for (auto id : ids) {
+      auto& events = stages[id].events.getEvents();
+      depends.insert(depends.end(), events.begin(), events.end());
+    }
+    return depends;
+  }
+
+  void wait() {
+    for (auto& stage : stages) { stage.events.wait(); }
+  }
+
+  size_t size() const { return stages.size(); }
+  const std::string& getName(StageId id) const { return stages[id].name; }
+  std::chrono::duration<double> getProfilingInfo(StageId id) { return stages[id].events.getProfilingInfo(); }
+
+  /**
+   * Device time of all the stages with the given name.
+   */
+  std::chrono::duration<double> getTotalTime(const std::string& name) {
+    std::chrono::duration<double> total{0};
+    for (auto& stage : stages) {
+      if (stage.name == name) { total += stage.events.getProfilingInfo(); }
+    }
+    return total;
+  }
+
+private:
+  struct Stage {
+    std::string name;
+    BatchedEvent events;
+  };
+  std::vector<Stage> stages;
+};
+
 } // namespace utils
 } // namespace sigmo
\ No newline at end of file
@@ -4,12 +4,145 @@
  */
 
 #include "./utils.hpp"
+#include <future>
 #include <numeric>
+#include <optional>
 #include <sigmo.hpp>
 #include <sycl/sycl.hpp>
 
+/**
+ * Read the query and data graphs, applying the size filter, the multiply factors and the limits.
+ */
+std::pair<std::vector<sigmo::CSRGraph>, std::vector<sigmo::CSRGraph>> loadInputGraphs(const Args& args) {
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(args.query_file);
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(args.data_file);
+  if (args.query_filter.active) {
+    for (int i = 0; i < query_graphs.size(); ++i) {
+      if (query_graphs[i].getNumNodes() > args.query_filter.max_nodes || query_graphs[i].getNumNodes() < args.query_filter.min_nodes) {
+        query_graphs.erase(query_graphs.begin() + i);
+        i--;
+      }
+    }
+  }
+  const size_t num_query_graphs = query_graphs.size();
+  for (size_t i = 1; i < args.multiply_factor_query; ++i) {
+    query_graphs.insert(query_graphs.end(), query_graphs.begin(), query_graphs.begin() + num_query_graphs);
+  }
+  const size_t num_data_graphs = data_graphs.size();
+  for (size_t i = 1; i < args.multiply_factor_data; ++i) {
+    data_graphs.insert(data_graphs.end(), data_graphs.begin(), data_graphs.begin() + num_data_graphs);
+  }
+  if (query_graphs.size() > args.max_query_graphs) { query_graphs.erase(query_graphs.begin() + args.max_query_graphs, query_graphs.end()); }
+  if (data_graphs.size() > args.max_data_graphs) { data_graphs.erase(data_graphs.begin() + args.max_data_graphs, data_graphs.end()); }
+  return {std::move(query_graphs), std::move(data_graphs)};
+}
+
+/**
+ * Run the pipeline on the native host backend, reporting in the format of the SYCL path.
+ */
+int runHost(const Args& args, std::vector<sigmo::CSRGraph>& query_graphs, std::vector<sigmo::CSRGraph>& data_graphs) {
+  sigmo::host::HostEngine engine{args.getEngineConfig(sigmo::device::deviceOptions), args.num_threads};
+  std::cout << "------------- Input Data -------------" << std::endl;
+  std::cout << "# Query Graphs " << query_graphs.size() << std::endl;
+  std::cout << "# Data Graphs " << data_graphs.size() << std::endl;
+  std::cout << "------------- Configs -------------" << std::endl;
+  std::cout << "Backend: host (" << engine.getNumThreads() << " threads)" << std::endl;
+  std::cout << "Find all: " << (args.find_all ? "Yes" : "No") << std::endl;
+
+  TimeEvents host_time_events;
+  host_time_events.add("setup_data_start");
+  engine.loadData(data_graphs);
+  host_time_events.add("setup_data_end");
+  auto result = engine.runQueries(query_graphs);
+  host_time_events.add("join_end");
+
+  std::cout << "------------- Overall Host Stats -------------" << std::endl;
+  std::cout << "Data signature time: " << std::chrono::duration_cast<std::chrono::milliseconds>(engine.getDataSignatureTime()).count() << " ms"
+            << std::endl;
+  std::cout << "Query signature time: " << std::chrono::duration_cast<std::chrono::milliseconds>(result.query_signature_time).count() << " ms"
+            << std::endl;
+  std::cout << "Filter and join time: " << std::chrono::duration_cast<std::chrono::milliseconds>(result.join_time).count() << " ms" << std::endl;
+  std::cout << "Total time: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(host_time_events.getRangeTime("setup_data_start", "join_end")).count() << " ms"
+            << std::endl;
+  std::cout << "------------- Results -------------" << std::endl;
+  std::cout << "# Pairs: " << formatNumber(result.pairs) << std::endl;
+  if (!args.skip_join) { std::cout << "# Matches: " << formatNumber(result.matches) << std::endl; }
+  return 0;
+}
+
+/**
+ * Run the pipeline on every device of --devices, each on a slice of the data graphs sized by its measured throughput.
+ */
+int runDevices(const Args& args, std::vector<sigmo::CSRGraph>& query_graphs, std::vector<sigmo::CSRGraph>& data_graphs) {
+  sigmo::MultiDeviceEngine engine{sigmo::device::selectDevices(args.devices), args.getEngineConfig(sigmo::device::deviceOptions)};
+  std::cout << "------------- Input Data -------------" << std::endl;
+  std::cout << "# Query Graphs " << query_graphs.size() << std::endl;
+  std::cout << "# Data Graphs " << data_graphs.size() << std::endl;
+  std::cout << "------------- Configs -------------" << std::endl;
+  std::cout << "Devices: " << engine.getNumDevices() << std::endl;
+  std::cout << "Find all: " << (args.find_all ? "Yes" : "No") << std::endl;
+
+  auto sized_query_graphs = sigmo::io::splitBySize(std::move(query_graphs), sigmo::types::MAX_DEVICE_QUERY_NODES);
+  auto sized_data_graphs = sigmo::io::splitBySize(std::move(data_graphs), sigmo::types::MAX_DEVICE_DATA_NODES);
+  const bool device_pairs = !sized_query_graphs.device.empty() && !sized_data_graphs.device.empty();
+  sigmo::host::FallbackEngine fallback{args.getEngineConfig(sigmo::device::deviceOptions), args.num_threads};
+  std::future<sigmo::QueryResult> fallback_result;
+
+  TimeEvents host_time_events;
+  host_time_events.add("calibration_start");
+  if (engine.getNumDevices() > 1 && device_pairs) { engine.calibrate(sized_query_graphs.device, sized_data_graphs.device); }
+  host_time_events.add("setup_data_start");
+  engine.loadData(sized_data_graphs.device);
+  fallback.loadData(std::move(sized_data_graphs.device), sized_data_graphs.oversized);
+  host_time_events.add("setup_data_end");
+  if (fallback.isNeeded(sized_query_graphs)) {
+    fallback_result = std::async(std::launch::async, [&]() { return fallback.runQueries(sized_query_graphs); });
+  }
+  auto result = device_pairs ? engine.runQueries(sized_query_graphs.device) : sigmo::QueryResult{};
+  if (fallback_result.valid()) {
+    auto host_result = fallback_result.get();
+    result.matches += host_result.matches;
+    result.pairs += host_result.pairs;
+    result.host_time = host_result.host_time;
+  }
+  host_time_events.add("join_end");
+
+  std::cout << "------------- Device Stats -------------" << std::endl;
+  for (size_t i = 0; i < engine.getNumDevices(); ++i) {
+    auto& device_result = engine.getDeviceResult(i);
+    std::cout << "[" << i << "] " << engine.getDevice(i).get_info<sycl::info::device::name>() << ": weight " << engine.getWeight(i) << ", "
+              << formatNumber(engine.getNumDataGraphs(i)) << " data graphs, " << formatNumber(device_result.matches) << " matches, "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(device_result.filter_time + device_result.join_time).count() << " ms"
+              << std::endl;
+  }
+  std::cout << "------------- Overall Stats -------------" << std::endl;
+  std::cout << "Calibration time: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(host_time_events.getRangeTime("calibration_start", "setup_data_start")).count()
+            << " ms" << std::endl;
+  std::cout << "Setup data time: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(host_time_events.getRangeTime("setup_data_start", "setup_data_end")).count()
+            << " ms" << std::endl;
+  std::cout << "Host fallback time: " << std::chrono::duration_cast<std::chrono::milliseconds>(result.host_time).count() << " ms" << std::endl;
+  std::cout << "Total time: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(host_time_events.getRangeTime("setup_data_start", "join_end")).count() << " ms"
+            << std::endl;
+  std::cout << "------------- Results -------------" << std::endl;
+  std::cout << "# Pairs: " << formatNumber(result.pairs) << std::endl;
+  if (!args.skip_join) { std::cout << "# Matches: " << formatNumber(result.matches) << std::endl; }
+  return 0;
+}
+
 int main(int argc, char** argv) {
   Args args{argc, argv, sigmo::device::deviceOptions};
+  if (args.query_data && args.isBackendHost()) {
+    auto [query_graphs, data_graphs] = loadInputGraphs(args);
+    return runHost(args, query_graphs, data_graphs);
+  }
+  if (args.query_data && args.isMultiDevice()) {
+    auto [query_graphs, data_graphs] = loadInputGraphs(args);
+    return runDevices(args, query_graphs, data_graphs);
+  }
 
   sigmo::DeviceBatchedCSRGraph device_data_graph;
   sigmo::DeviceBatchedCSRGraph device_query_graph;
@@ -21,30 +154,31 @@ int main(int argc, char** argv) {
   std::string gpu_name = queue.get_device().get_info<sycl::info::device::name>();
 
   TimeEvents host_time_events;
+  // the pairs involving a graph beyond the device limits are matched on the host threads, concurrently with the device
+  sigmo::host::FallbackEngine fallback{args.getEngineConfig(sigmo::device::deviceOptions), args.num_threads};
+  sigmo::io::SizedGraphs sized_query_graphs;
+  std::future<sigmo::QueryResult> fallback_result;
 
   if (args.query_data) {
-    auto query_graphs = sigmo::io::loadCSRGraphsFromFile(args.query_file);
-    auto data_graphs = sigmo::io::loadCSRGraphsFromFile(args.data_file);
-    if (args.query_filter.active) {
-      for (int i = 0; i < query_graphs.size(); ++i) {
-        if (query_graphs[i].getNumNodes() > args.query_filter.max_nodes || query_graphs[i].getNumNodes() < args.query_filter.min_nodes) {
-          query_graphs.erase(query_graphs.begin() + i);
-          i--;
-        }
-      }
-    }
-    num_query_graphs = query_graphs.size();
-    for (size_t i = 1; i < args.multiply_factor_query; ++i) {
-      query_graphs.insert(query_graphs.end(), query_graphs.begin(), query_graphs.begin() + num_query_graphs);
+    auto [query_graphs, data_graphs] = loadInputGraphs(args);
+    sized_query_graphs = sigmo::io::splitBySize(std::move(query_graphs), sigmo::types::MAX_DEVICE_QUERY_NODES);
+    auto sized_data_graphs = sigmo::io::splitBySize(std::move(data_graphs), sigmo::types::MAX_DEVICE_DATA_NODES);
+    if (sized_query_graphs.device.empty() || sized_data_graphs.device.empty()) {
+      auto all_query_graphs = sized_query_graphs.device;
+      all_query_graphs.insert(all_query_graphs.end(), sized_query_graphs.oversized.begin(), sized_query_graphs.oversized.end());
+      auto all_data_graphs = sized_data_graphs.device;
+      all_data_graphs.insert(all_data_graphs.end(), sized_data_graphs.oversized.begin(), sized_data_graphs.oversized.end());
+      return runHost(args, all_query_graphs, all_data_graphs);
     }
-    num_data_graphs = data_graphs.size();
-    for (size_t i = 1; i < args.multiply_factor_data; ++i) {
-      data_graphs.insert(data_graphs.end(), data_graphs.begin(), data_graphs.begin() + num_data_graphs);
+    device_query_graph = sigmo::createDeviceCSRGraph(queue, sized_query_graphs.device);
+    device_data_graph = sigmo::createDeviceCSRGraph(queue, sized_data_graphs.device);
+    fallback.loadData(std::move(sized_data_graphs.device), sized_data_graphs.oversized);
+    if (fallback.isNeeded(sized_query_graphs)) {
+      std::cout << "Routed to the host: " << sized_data_graphs.oversized.size() << " data graphs over " << sigmo::types::MAX_DEVICE_DATA_NODES
+                << " nodes, " << sized_query_graphs.oversized.size() << " query graphs over " << sigmo::types::MAX_DEVICE_QUERY_NODES << " nodes"
+                << std::endl;
+      fallback_result = std::async(std::launch::async, [&]() { return fallback.runQueries(sized_query_graphs); });
     }
-    if (query_graphs.size() > args.max_query_graphs) { query_graphs.erase(query_graphs.begin() + args.max_query_graphs, query_graphs.end()); }
-    if (data_graphs.size() > args.max_data_graphs) { data_graphs.erase(data_graphs.begin() + args.max_data_graphs, data_graphs.end()); }
-    device_query_graph = sigmo::createDeviceCSRGraph(queue, query_graphs);
-    device_data_graph = sigmo::createDeviceCSRGraph(queue, data_graphs);
   } else {
     throw std::runtime_error("Specify input data");
   }
@@ -66,8 +200,12 @@ int main(int argc, char** argv) {
   std::cout << "# Data Nodes " << data_nodes << std::endl;
   std::cout << "# Data Graphs " << num_data_graphs << std::endl;
 
+  const sigmo::CandidatesDomain domain = args.getCandidatesDomain(query_nodes, data_nodes);
+  const bool data_domain = domain == sigmo::CandidatesDomain::Data;
+
   std::cout << "------------- Configs -------------" << std::endl;
-  std::cout << "Filter domain: " << args.candidates_domain << std::endl;
+  std::cout << "Filter domain: " << (data_domain ? "data" : "query") << std::endl;
+  std::cout << "Candidates layout: " << (args.aligned_candidates && !data_domain ? "aligned" : "packed") << std::endl;
   std::cout << "Filter Work Group Size: " << sigmo::device::deviceOptions.filter_work_group_size << std::endl;
   std::cout << "Join Work Group Size: " << sigmo::device::deviceOptions.join_work_group_size << std::endl;
   std::cout << "Find all: " << (args.find_all ? "Yes" : "No") << std::endl;
@@ -77,11 +215,15 @@ int main(int argc, char** argv) {
   std::cout << "Allocated " << getBytesSize(data_graph_bytes) << " for graph data" << std::endl;
   std::cout << "Allocated " << getBytesSize(query_graphs_bytes) << " for query data" << std::endl;
 
-  sigmo::candidates::Candidates candidates{queue, query_nodes, data_nodes};
+  sigmo::candidates::Candidates candidates{queue, query_nodes, device_data_graph, args.getCandidatesLayout(), domain};
   size_t candidates_bytes = candidates.getAllocationSize();
-  std::cout << "Allocated " << getBytesSize(candidates_bytes) << " for candidates" << std::endl;
+  std::cout << "Allocated " << getBytesSize(candidates_bytes) << " for candidates";
+  if (candidates.getLayout() == sigmo::CandidatesLayout::Aligned) { std::cout << " (" << getBytesSize(candidates.getPaddingSize()) << " padding)"; }
+  std::cout << std::endl;
 
-  sigmo::signature::Signature<> signatures{queue, device_data_graph.total_nodes, device_query_graph.total_nodes};
+  // the query side is tiny, on its own queue it overlaps the data side instead of queuing behind it
+  sycl::queue query_queue{queue.get_context(), queue.get_device(), sycl::property::queue::enable_profiling{}};
+  sigmo::signature::Signature<> signatures{queue, query_queue, device_data_graph.total_nodes, device_query_graph.total_nodes};
   size_t data_signatures_bytes = signatures.getDataSignatureAllocationSize();
   std::cout << "Allocated " << getBytesSize(data_signatures_bytes) << " for data signatures" << std::endl;
   size_t query_signatures_bytes = signatures.getQuerySignatureAllocationSize();
@@ -97,50 +239,59 @@ int main(int argc, char** argv) {
 
   std::cout << "------------- Runtime Filter Phase -------------" << std::endl;
   host_time_events.add("filter_start");
-  std::cout << "[*] Initialization Step:" << std::endl;
-  std::chrono::duration<double> time;
-  auto e1 = signatures.generateDataSignatures(device_data_graph);
-  queue.wait_and_throw();
-  time = e1.getProfilingInfo();
-  data_sig_times.push_back(time);
-  std::cout << "- Data signatures generated in " << std::chrono::duration_cast<std::chrono::milliseconds>(time).count() << " ms" << std::endl;
-
-  auto e2 = signatures.generateQuerySignatures(device_query_graph);
-  queue.wait_and_throw();
-  time = e2.getProfilingInfo();
-  query_sig_times.push_back(time);
-  std::cout << "- Query signatures generated in " << std::chrono::duration_cast<std::chrono::milliseconds>(time).count() << " ms" << std::endl;
-
-  auto e3 = sigmo::isomorphism::filter::filterCandidates(queue, device_query_graph, device_data_graph, signatures, candidates);
-  queue.wait_and_throw();
-  time = e3.getProfilingInfo();
-  filter_times.push_back(time);
-  std::cout << "- Candidates filtered in " << std::chrono::duration_cast<std::chrono::milliseconds>(time).count() << " ms" << std::endl;
-
-  // start refining candidate set
+  // the whole filter phase is submitted up front as a dependency graph, the host synchronizes once
+  using sigmo::utils::StageGraph;
+  StageGraph stages;
+  auto data_sig = stages.add("Data signatures", signatures.generateDataSignatures(device_data_graph));
+  auto query_sig = stages.add("Query signatures", signatures.generateQuerySignatures(device_query_graph));
+  auto filter_depends = stages.after({data_sig, query_sig});
+  auto filter = stages.add("Candidates",
+                           data_domain ? sigmo::isomorphism::filter::filterCandidates<sigmo::CandidatesDomain::Data>(
+                                             queue, device_query_graph, device_data_graph, signatures, candidates, filter_depends)
+                                       : sigmo::isomorphism::filter::filterCandidates<sigmo::CandidatesDomain::Query>(
+                                             queue, device_query_graph, device_data_graph, signatures, candidates, filter_depends));
   for (size_t ref_step = 1; ref_step <= args.refinement_steps; ++ref_step) {
-    std::cout << "[*] Refinement step " << ref_step << ":" << std::endl;
-
-    auto e1 = signatures.refineDataSignatures(device_data_graph, ref_step);
-    queue.wait_and_throw();
-    time = e1.getProfilingInfo();
-    data_sig_times.push_back(time);
-    std::cout << "- Data signatures refined in " << std::chrono::duration_cast<std::chrono::milliseconds>(time).count() << " ms" << std::endl;
-
-    auto e2 = signatures.refineQuerySignatures(device_query_graph, ref_step);
-    queue.wait_and_throw();
-    time = e2.getProfilingInfo();
-    query_sig_times.push_back(time);
-    std::cout << "- Query signatures refined in " << std::chrono::duration_cast<std::chrono::milliseconds>(time).count() << " ms" << std::endl;
-
-    auto e3 = sigmo::isomorphism::filter::refineCandidates(queue, device_query_graph, device_data_graph, signatures, candidates);
-    queue.wait_and_throw();
-    time = e3.getProfilingInfo();
-    filter_times.push_back(time);
-    std::cout << "- Candidates refined in " << std::chrono::duration_cast<std::chrono::milliseconds>(time).count() << " ms" << std::endl;
+    // the signatures are refined in place, so they wait for the previous filter to read them
+    auto data_depends = stages.after({data_sig, filter});
+    auto query_depends = stages.after({query_sig, filter});
+    data_sig = stages.add("Data signatures", signatures.refineDataSignatures(device_data_graph, ref_step, data_depends));
+    query_sig = stages.add("Query signatures", signatures.refineQuerySignatures(device_query_graph, ref_step, query_depends));
+    auto filter_depends = stages.after({data_sig, query_sig});
+    filter = stages.add("Candidates",
+                        data_domain ? sigmo::isomorphism::filter::refineCandidates<sigmo::CandidatesDomain::Data>(
+                                          queue, device_query_graph, device_data_graph, signatures, candidates, filter_depends)
+                                    : sigmo::isomorphism::filter::refineCandidates<sigmo::CandidatesDomain::Query>(
+                                          queue, device_query_graph, device_data_graph, signatures, candidates, filter_depends));
+  }
+  stages.wait();
+
+  std::chrono::duration<double> time;
+  for (StageGraph::StageId stage = 0; stage < stages.size(); ++stage) {
+    const size_t ref_step = stage / 3;
+    if (stage % 3 == 0 && ref_step == 0) { std::cout << "[*] Initialization Step:" << std::endl; }
+    if (stage % 3 == 0 && ref_step > 0) { std::cout << "[*] Refinement step " << ref_step << ":" << std::endl; }
+    time = stages.getProfilingInfo(stage);
+    const auto& name = stages.getName(stage);
+    if (name == "Data signatures") { data_sig_times.push_back(time); }
+    if (name == "Query signatures") { query_sig_times.push_back(time); }
+    if (name == "Candidates") { filter_times.push_back(time); }
+    const char* verb = ref_step > 0 ? " refined" : (name == "Candidates" ? " filtered" : " generated");
+    std::cout << "- " << name << verb << " in " << std::chrono::duration_cast<std::chrono::milliseconds>(time).count() << " ms" << std::endl;
   }
   host_time_events.add("filter_end");
 
+  // inspect the candidates before the join, the dense bitmap may be released by the compaction
+  CandidatesInspector inspector;
+  if (!args.skip_print_candidates) {
+    auto counts = candidates.getQueryCandidatesCount();
+    for (size_t i = 0; i < query_nodes; ++i) {
+      auto count = counts[i];
+      inspector.add(count);
+      if (args.print_candidates) std::cerr << "Node " << i << ": " << count << std::endl;
+    }
+    inspector.finalize();
+  }
+
   std::chrono::duration<double> join_time{0};
   size_t* num_matches = sycl::malloc_shared<size_t>(1, queue);
   num_matches[0] = 0;
@@ -148,15 +299,90 @@ int main(int argc, char** argv) {
     std::cout << "[*] Generating DQCR" << std::endl;
     host_time_events.add("mapping_start");
     sigmo::isomorphism::mapping::GMCR gmcr{queue};
-    gmcr.generateGMCR(device_query_graph, device_data_graph, candidates);
+    sigmo::candidates::PairCandidates pair_candidates{queue};
+    if (args.compact_candidates) {
+      pair_candidates.generatePairCandidates(device_query_graph, device_data_graph, candidates);
+      candidates.release();
+      std::cout << "- Compacted " << formatNumber(pair_candidates.getNumPairs()) << " pairs in "
+                << getBytesSize(pair_candidates.getAllocationSize()) << " (dense " << getBytesSize(candidates_bytes) << ")" << std::endl;
+      gmcr.generateGMCR(device_query_graph, device_data_graph, pair_candidates);
+    } else {
+      gmcr.generateGMCR(device_query_graph, device_data_graph, candidates);
+    }
+    sigmo::candidates::PairCandidateLists candidate_lists{queue};
+    if (args.cache_candidates) {
+      if (args.compact_candidates) {
+        candidate_lists.generateCandidateLists(device_query_graph, device_data_graph, pair_candidates, gmcr.getGMCRDevice());
+      } else {
+        candidate_lists.generateCandidateLists(device_query_graph, device_data_graph, candidates, gmcr.getGMCRDevice());
+      }
+      if (candidate_lists.isAvailable()) {
+        std::cout << "- Cached " << formatNumber(candidate_lists.getNumCandidates()) << " candidates in "
+                  << getBytesSize(candidate_lists.getAllocationSize()) << std::endl;
+      } else {
+        std::cout << "- Candidate lists exceed the memory budget, joining on the bitmap" << std::endl;
+      }
+    }
+    const bool use_trie = args.isJoinEngineTrie() && args.find_all;
+    std::optional<sigmo::isomorphism::trie::QueryTrie> trie;
+    if (use_trie) {
+      trie.emplace(queue, device_query_graph);
+      std::cout << "- Query trie: " << formatNumber(trie->getNumNodes()) << " nodes for " << formatNumber(trie->getNumIndexedQueryNodes())
+                << " query nodes in " << getBytesSize(trie->getAllocationSize()) << std::endl;
+      if (trie->getSkippedQueries() > 0) {
+        std::cout << "- Skipped " << formatNumber(trie->getSkippedQueries()) << " queries above the trie depth" << std::endl;
+      }
+    }
     host_time_events.add("mapping_end");
     std::cout << "[*] Starting Join" << std::endl;
     host_time_events.add("join_start");
-    auto join_e
-        = sigmo::isomorphism::join::joinCandidates(queue, device_query_graph, device_data_graph, candidates, gmcr, num_matches, !args.find_all);
+    sigmo::isomorphism::join::JoinDispatcher dispatcher{queue, args.getJoinPolicy(), true}; // the shares are printed below
+    sigmo::isomorphism::join::BFSJoinEngine bfs_engine{queue};
+    sigmo::utils::BatchedEvent join_e;
+    bool use_bfs = args.isJoinEngineBFS() && args.find_all;
+    if ((args.isJoinEngineBFS() || args.isJoinEngineTrie()) && !args.find_all) {
+      std::cout << "- The " << args.join_engine << " join engine needs --find-all, using the DFS kernels" << std::endl;
+    }
+    if (use_trie) {
+      join_e = sigmo::isomorphism::join::joinTrie(queue, device_data_graph, *trie, gmcr, num_matches);
+    } else if (use_bfs && candidate_lists.isAvailable()) {
+      join_e = bfs_engine.run(device_query_graph, device_data_graph, candidate_lists, gmcr, num_matches);
+    } else if (use_bfs && args.compact_candidates) {
+      join_e = bfs_engine.run(device_query_graph, device_data_graph, pair_candidates, gmcr, num_matches);
+    } else if (use_bfs) {
+      join_e = bfs_engine.run(device_query_graph, device_data_graph, candidates, gmcr, num_matches);
+    } else if (candidate_lists.isAvailable()) {
+      join_e = dispatcher.run(device_query_graph, device_data_graph, candidate_lists, gmcr, num_matches, !args.find_all);
+    } else if (args.compact_candidates) {
+      join_e = dispatcher.run(device_query_graph, device_data_graph, pair_candidates, gmcr, num_matches, !args.find_all);
+    } else {
+      join_e = dispatcher.run(device_query_graph, device_data_graph, candidates, gmcr, num_matches, !args.find_all);
+    }
     join_e.wait();
     join_time = join_e.getProfilingInfo();
     host_time_events.add("join_end");
+    if (use_bfs) {
+      std::cout << "- BFS: " << bfs_engine.getLevels() << " levels, peak frontier " << formatNumber(bfs_engine.getPeakFrontier()) << " embeddings"
+                << (bfs_engine.usedDepthFirst() ? ", completed depth-first over the memory budget" : "") << std::endl;
+      if (bfs_engine.getDeepPairs() > 0) {
+        std::cout << "- BFS: " << formatNumber(bfs_engine.getDeepPairs()) << " pairs with queries larger than "
+                  << sigmo::isomorphism::join::BFSJoinEngine::MAX_QUERY_NODES << " nodes joined depth-first" << std::endl;
+      }
+      if (bfs_engine.getOversizedPairs() > 0) {
+        std::cout << "- Skipped " << formatNumber(bfs_engine.getOversizedPairs()) << " pairs with queries larger than "
+                  << sigmo::isomorphism::join::BFSJoinEngine::DEEP_QUERY_NODES << " nodes" << std::endl;
+      }
+    }
+    for (auto& share : dispatcher.getShares()) {
+      if (share.pairs == 0) continue;
+      std::cout << "- " << share.kernel << ": " << formatNumber(share.data_graphs) << " data graphs, " << formatNumber(share.pairs) << " pairs, "
+                << formatNumber(share.matches) << " matches in " << std::chrono::duration_cast<std::chrono::milliseconds>(share.time).count() << " ms"
+                << std::endl;
+    }
+    if (dispatcher.getOversizedPairs() > 0) {
+      std::cout << "- Skipped " << formatNumber(dispatcher.getOversizedPairs()) << " pairs with queries larger than "
+                << std::end(sigmo::isomorphism::join::JOIN_DEPTH_CLASSES)[-1] << " nodes" << std::endl;
+    }
   }
   std::cout << "[!] End" << std::endl;
 
@@ -197,22 +423,21 @@ int main(int argc, char** argv) {
   std::cout << "Total time: " << std::chrono::duration_cast<std::chrono::milliseconds>(host_time_events.getTimeFrom("setup_data_end")).count()
             << " ms" << std::endl;
 
+  sigmo::QueryResult host_result;
+  if (fallback_result.valid()) {
+    host_result = fallback_result.get();
+    std::cout << "Host fallback time: " << std::chrono::duration_cast<std::chrono::milliseconds>(host_result.host_time).count()
+              << " ms (overlapping the device)" << std::endl;
+  }
+
   std::cout << "------------- Results -------------" << std::endl;
   if (!args.skip_print_candidates) {
-    CandidatesInspector inspector;
-    auto host_candidates = candidates.getHostCandidates();
-    for (size_t i = 0; i < query_nodes; ++i) {
-      auto count = host_candidates.getCandidatesCount(i);
-      inspector.add(count);
-      if (args.print_candidates) std::cerr << "Node " << i << ": " << count << std::endl;
-    }
-    inspector.finalize();
     std::cout << "# Total candidates: " << formatNumber(inspector.total) << std::endl;
     std::cout << "# Average candidates: " << formatNumber(inspector.avg) << std::endl;
     std::cout << "# Median candidates: " << formatNumber(inspector.median) << std::endl;
     std::cout << "# Zero candidates: " << formatNumber(inspector.zero_count) << std::endl;
   }
-  if (!args.skip_join) { std::cout << "# Matches: " << formatNumber(num_matches[0]) << std::endl; }
+  if (!args.skip_join) { std::cout << "# Matches: " << formatNumber(num_matches[0] + host_result.matches) << std::endl; }
 
   sycl::free(num_matches, queue);
   sigmo::destroyDeviceCSRGraph(device_data_graph, queue);
@@ -12,76 +12,218 @@
  #include <vector>
  #include <string>
  #include <iostream>
+ #include <future>
+ #include <cstdint>
+ #include <algorithm>
  
- // Helper function to read a text file using MPI-IO and split it into lines.
- // Each MPI rank reads its file chunk, adjusts for incomplete lines at the boundaries,
- // and returns at most max_lines complete lines.
-std::vector<std::string> loadFileLinesMPI(const std::string &filename, int max_lines) {
-	MPI_File mpi_file;
-	// Open the file collectively for reading.
-	MPI_File_open(MPI_COMM_WORLD, filename.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &mpi_file);
-
-	// Get the size of the file in bytes.
-	MPI_Offset file_size;
-	MPI_File_get_size(mpi_file, &file_size);
-
-	// Get the MPI rank and number of processes.
-	int rank, nprocs;
+ // The line index of a data file, read from its sidecar (or built and written on the first read) by rank 0 and
+ // broadcast, so that every rank can cut exact line ranges out of the file.
+sigmo::io::LineIndex broadcastLineIndex(const std::string &filename) {
+	int rank;
 	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-	MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+	sigmo::io::LineIndex index;
+	std::string error;
+	if (rank == 0) {
+		try {
+			index = sigmo::io::LineIndex::loadOrBuild(filename);
+		} catch (const std::exception &e) {
+			error = e.what();
+		}
+	}
+	// the status goes first so that a failure on rank 0 reaches every rank instead of leaving them in the broadcasts below
+	uint64_t header[3] = {error.empty(), index.file_size, index.offsets.size()};
+	MPI_Bcast(header, 3, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+	if (!header[0]) {
+		throw std::runtime_error(rank == 0 ? error : "Cannot index " + filename + " on rank 0");
+	}
+	index.file_size = header[1];
+	index.offsets.resize(header[2]);
+	const size_t piece = size_t{1} << 27; // MPI counts are int
+	for (size_t i = 0; i < index.offsets.size(); i += piece) {
+		int count = static_cast<int>(std::min(piece, index.offsets.size() - i));
+		MPI_Bcast(index.offsets.data() + i, count, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+	}
+	return index;
+}
 
-	// Compute the basic chunk size (integer division).
-	MPI_Offset chunk_size = file_size / nprocs;
-	MPI_Offset start = rank * chunk_size;
-	MPI_Offset end = start + (max_lines * 2048);//(rank == nprocs - 1) ? file_size : start + chunk_size;
+// Open the file for reading on every rank, MPI file errors are returned rather than raised.
+MPI_File openFileMPI(const std::string &filename) {
+	MPI_File file;
+	if (MPI_File_open(MPI_COMM_WORLD, filename.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+		throw std::runtime_error("Cannot open " + filename);
+	}
+	return file;
+}
 
-	// Read extra bytes to cover a potential partial line at the chunk boundary.
-	const int extra = 1024;
-	std::vector<char> buffer((end - start) + extra, '\0');
+// Read the lines [begin_line, end_line) of the file with a single MPI_File_read_at (split only beyond the int count).
+std::vector<std::string> readIndexedLines(MPI_File file, const sigmo::io::LineIndex &index, size_t begin_line, size_t end_line) {
+	std::vector<std::string> lines;
+	if (begin_line >= end_line) {
+		return lines;
+	}
+	const MPI_Offset from = index.offsets[begin_line];
+	const MPI_Offset to = index.offsets[end_line];
+	std::string data(to - from, '\0');
+	const MPI_Offset piece = MPI_Offset{1} << 30;
+	for (MPI_Offset offset = 0; offset < to - from; offset += piece) {
+		int count = static_cast<int>(std::min(piece, to - from - offset));
+		MPI_Status status;
+		int read = 0;
+		if (MPI_File_read_at(file, from + offset, data.data() + offset, count, MPI_CHAR, &status) != MPI_SUCCESS
+		    || MPI_Get_count(&status, MPI_CHAR, &read) != MPI_SUCCESS || read != count) {
+			throw std::runtime_error("Short read of the data file at byte " + std::to_string(from + offset));
+		}
+	}
+	lines.reserve(end_line - begin_line);
+	for (size_t i = begin_line; i < end_line; ++i) {
+		size_t begin = index.offsets[i] - from;
+		size_t length = index.offsets[i + 1] - index.offsets[i];
+		while (length > 0 && (data[begin + length - 1] == '\n' || data[begin + length - 1] == '\r')) {
+			length--;
+		}
+		if (length > 0) {
+			lines.emplace_back(data, begin, length);
+		}
+	}
+	return lines;
+}
 
-	// Read the file chunk collectively.
-	MPI_File_read_at_all(mpi_file, start, buffer.data(), buffer.size(), MPI_CHAR, MPI_STATUS_IGNORE);
-	MPI_File_close(&mpi_file);
+ // Static partition of a text file: rank r takes the lines [r * n / nprocs, (r + 1) * n / nprocs) of the line index,
+ // at most max_lines of them, so the ranks never overlap nor leave gaps.
+std::vector<std::string> loadFileLinesMPI(const std::string &filename, const sigmo::io::LineIndex &index, size_t max_lines) {
+	int rank, nprocs;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+	const size_t num_lines = index.getNumLines();
+	const size_t begin_line = num_lines * rank / nprocs;
+	const size_t end_line = std::min(num_lines * (rank + 1) / nprocs, begin_line + max_lines);
 
-	// Convert the buffer into a string.
-	std::string data(buffer.data(), buffer.size());
+	MPI_File mpi_file = openFileMPI(filename);
+	auto lines = readIndexedLines(mpi_file, index, begin_line, end_line);
+	MPI_File_close(&mpi_file);
+	return lines;
+}
 
-	// For non-first ranks, skip a potential partial first line.
-	if (rank != 0) {
-		size_t first_newline = data.find('\n');
-		if (first_newline != std::string::npos) {
-			data = data.substr(first_newline + 1);
+// Shared index of the next data chunk, held by rank 0 and advanced by every rank with an atomic fetch-and-add,
+// so that faster ranks simply claim more chunks.
+class ChunkCounter {
+public:
+	explicit ChunkCounter(MPI_Comm comm) {
+		int rank;
+		MPI_Comm_rank(comm, &rank);
+		MPI_Win_allocate(rank == 0 ? sizeof(uint64_t) : 0, sizeof(uint64_t), MPI_INFO_NULL, comm, &counter, &win);
+		if (rank == 0) {
+			MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
+			*counter = 0;
+			MPI_Win_unlock(0, win);
 		}
+		MPI_Barrier(comm);
 	}
 
-	// For non-last ranks, remove any partial last line by cutting at the final newline.
-	if (rank != nprocs - 1) {
-		size_t last_newline = data.rfind('\n');
-		if (last_newline != std::string::npos) {
-			data = data.substr(0, last_newline);
-		}
+	ChunkCounter(const ChunkCounter&) = delete;
+	ChunkCounter& operator=(const ChunkCounter&) = delete;
+
+	~ChunkCounter() { MPI_Win_free(&win); }
+
+	uint64_t next() {
+		const uint64_t one = 1;
+		uint64_t chunk;
+		MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
+		MPI_Fetch_and_op(&one, &chunk, MPI_UINT64_T, 0, 0, MPI_SUM, win);
+		MPI_Win_unlock(0, win);
+		return chunk;
 	}
 
-	// Split the data into individual lines.
-	std::istringstream iss(data);
-	std::string line;
-	std::vector<std::string> lines;
-	while (std::getline(iss, line) && lines.size() < static_cast<size_t>(max_lines)) {
-		lines.push_back(line);
+private:
+	MPI_Win win;
+	uint64_t* counter;
+};
+
+struct DataChunk {
+	bool done = false; // the chunk starts past the end of the file
+	std::vector<sigmo::CSRGraph> graphs;
+};
+
+// The lines starting in [chunk * chunk_bytes, (chunk + 1) * chunk_bytes). A line belongs to the chunk of its first
+// byte, so the chunks cover the file exactly once whatever the line lengths.
+DataChunk readDataChunk(MPI_File file, const sigmo::io::LineIndex &index, uint64_t chunk, uint64_t chunk_bytes) {
+	DataChunk result;
+	const uint64_t start = chunk * chunk_bytes;
+	if (start >= index.file_size) {
+		result.done = true;
+		return result;
 	}
+	auto line_starts_end = index.offsets.end() - 1; // the last offset is the end of the file
+	const size_t begin_line = std::lower_bound(index.offsets.begin(), line_starts_end, start) - index.offsets.begin();
+	const size_t end_line = std::lower_bound(index.offsets.begin(), line_starts_end, start + chunk_bytes) - index.offsets.begin();
+	result.graphs = sigmo::io::loadCSRGraphsFromLines(readIndexedLines(file, index, begin_line, end_line));
+	return result;
+}
 
-	lines.erase(std::remove_if(lines.begin(), lines.end(), [](const std::string &line) {
-	return (std::count(line.begin(), line.end(), 'n') != 1 ||
-					std::count(line.begin(), line.end(), 'e') != 1 ||
-					std::count(line.begin(), line.end(), 'l') != 1);
-	}), lines.end());
+struct RankResult {
+	size_t matches = 0;
+	size_t data_graphs = 0;
+	size_t oversized_data_graphs = 0;
+	size_t chunks = 0;
+};
 
-	return lines;
+// Static schedule: every rank matches the part of the data file loadFileLinesMPI assigns it.
+RankResult runStatic(const Args& args, const sigmo::io::LineIndex& index, sigmo::HybridEngine& engine, std::vector<sigmo::CSRGraph>& query_graphs) {
+	std::vector<std::string> data_lines = loadFileLinesMPI(args.data_file, index, args.max_data_graphs);
+	auto data_graphs = sigmo::io::loadCSRGraphsFromLines(data_lines);
+	RankResult result;
+	result.data_graphs = data_graphs.size();
+	result.chunks = 1;
+	engine.loadData(data_graphs);
+	result.matches = engine.runQueries(query_graphs).matches;
+	result.oversized_data_graphs = engine.getNumOversizedDataGraphs();
+	return result;
 }
- 
+
+// Dynamic schedule: every rank claims chunks of the data file until none is left, reading and parsing the next chunk
+// on a helper thread while the device matches the current one. The helper thread is the only one calling MPI in the
+// meantime, which MPI_THREAD_SERIALIZED allows; below that level the chunks are read on demand. A rank that reaches
+// max_data_graphs stops claiming, so the chunks it never matches are left to the other ranks.
+RankResult runDynamic(const Args& args,
+                      const sigmo::io::LineIndex& index,
+                      sigmo::HybridEngine& engine,
+                      std::vector<sigmo::CSRGraph>& query_graphs,
+                      bool async_io) {
+	MPI_File file = openFileMPI(args.data_file);
+	const uint64_t chunk_bytes = static_cast<uint64_t>(args.mpi_chunk_kb) << 10;
+
+	RankResult result;
+	{
+		ChunkCounter counter{MPI_COMM_WORLD};
+		auto fetch = [&]() { return readDataChunk(file, index, counter.next(), chunk_bytes); };
+		const auto policy = async_io ? std::launch::async : std::launch::deferred;
+		std::future<DataChunk> next;
+		if (args.max_data_graphs > 0) { next = std::async(policy, fetch); }
+		while (next.valid()) {
+			auto chunk = next.get();
+			if (chunk.done) { break; }
+			if (chunk.graphs.size() > args.max_data_graphs - result.data_graphs) {
+				chunk.graphs.erase(chunk.graphs.begin() + (args.max_data_graphs - result.data_graphs), chunk.graphs.end());
+			}
+			// claim the next chunk only while this rank can still take graphs from it
+			if (result.data_graphs + chunk.graphs.size() < args.max_data_graphs) { next = std::async(policy, fetch); }
+			if (chunk.graphs.empty()) { continue; }
+			engine.loadData(chunk.graphs);
+			result.matches += engine.runQueries(query_graphs).matches;
+			result.data_graphs += chunk.graphs.size();
+			result.oversized_data_graphs += engine.getNumOversizedDataGraphs();
+			result.chunks++;
+		}
+		MPI_Barrier(MPI_COMM_WORLD); // the counter window is freed collectively
+	}
+	MPI_File_close(&file);
+	return result;
+}
+
  int main(int argc, char** argv) {
-	// Initialize MPI.
-	MPI_Init(&argc, &argv);
+	// Initialize MPI, the dynamic schedule reads the next data chunk on a helper thread.
+	int thread_level;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &thread_level);
 	
 	// Get MPI rank and size 
 	int mpi_rank, mpi_size, local_rank;
@@ -105,103 +247,58 @@ std::vector<std::string> loadFileLinesMPI(const std::string &filename, int max_l
   // Create a SYCL queue with the selected device and profiling enabled.
   sycl::queue queue{selected_device, sycl::property::queue::enable_profiling{}};
 
-	// --- Read data_file in parallel using MPI-IO ---
-	// Set the maximum number of lines per node.
-	std::vector<std::string> data_lines = loadFileLinesMPI(args.data_file, args.max_data_graphs);
-	
-	// TODO: Parse the read lines into CSR graphs.
-	// You need to implement sigmo::io::parseCSRGraphsFromLines to convert the lines into the expected CSR graphs.
-	auto data_graphs = sigmo::io::loadCSRGraphsFromLines(data_lines);
-	
+	// Exact line ranges of the data file for either schedule.
+	auto index = broadcastLineIndex(args.data_file);
+
 	// Load query graphs using the existing (serial) routine.
 	auto query_graphs = sigmo::io::loadCSRGraphsFromFile(args.query_file);
-	
 	size_t num_query_graphs = query_graphs.size();
-	size_t num_data_graphs = data_graphs.size();
 	
-	sigmo::DeviceBatchedCSRGraph device_data_graph;
-	sigmo::DeviceBatchedCSRGraph device_query_graph;
-	
-	device_query_graph = sigmo::createDeviceCSRGraph(queue, query_graphs);
-	device_data_graph = sigmo::createDeviceCSRGraph(queue, data_graphs);
-	
-	size_t data_graph_bytes = sigmo::getDeviceGraphAllocSize(device_data_graph);
-	size_t query_graphs_bytes = sigmo::getDeviceGraphAllocSize(device_query_graph);
-	
-	std::vector<std::chrono::duration<double>> data_sig_times, query_sig_times, filter_times;
 	TimeEvents host_time_events;
 	
-	size_t query_nodes = device_query_graph.total_nodes;
-	size_t data_nodes = device_data_graph.total_nodes;
-	
-	size_t total_data_graphs = 0;
-	MPI_Reduce(&num_data_graphs, &total_data_graphs, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	// the candidates domain is picked per data batch unless forced
+	sigmo::EngineConfig config = args.getEngineConfig(sigmo::device::deviceOptions);
+	const bool dynamic = args.isMPIScheduleDynamic();
 
 	if (mpi_rank == 0) {
 		std::cout << "------------- Input Data -------------" << std::endl;
-		std::cout << "Read data and query graphs" << std::endl;
 		std::cout << "# Query Graphs " << num_query_graphs << std::endl;
-		std::cout << "# Data Graphs " << total_data_graphs << std::endl;
 		
 		std::cout << "------------- Configs -------------" << std::endl;
+		std::cout << "Schedule: " << (dynamic ? "dynamic, " + std::to_string(args.mpi_chunk_kb) + " KiB chunks" : "static") << std::endl;
+		if (dynamic && thread_level < MPI_THREAD_SERIALIZED) {
+			std::cout << "MPI without MPI_THREAD_SERIALIZED, chunks are not prefetched" << std::endl;
+		}
 		std::cout << "Filter domain: " << args.candidates_domain << std::endl;
 		std::cout << "Filter Work Group Size: " << sigmo::device::deviceOptions.filter_work_group_size << std::endl;
 		std::cout << "Join Work Group Size: " << sigmo::device::deviceOptions.join_work_group_size << std::endl;
 		std::cout << "Find all: " << (args.find_all ? "Yes" : "No") << std::endl;
 	}
 	
-	sigmo::candidates::Candidates candidates{queue, query_nodes, data_nodes};
-	
-	sigmo::signature::Signature<> signatures{queue, device_data_graph.total_nodes, device_query_graph.total_nodes};
-	host_time_events.add("setup_data_start");
-	host_time_events.add("setup_data_end");
+	// graphs beyond the device limits are matched on the host threads, overlapping the device pipeline
+	sigmo::HybridEngine engine{queue, config, args.num_threads};
 
 	MPI_Barrier(MPI_COMM_WORLD);
 	if (mpi_rank == 0) {
 		host_time_events.add("mpi_start");
 	}
-// Synchronize all ranks to ensure they have completed their setup.
-	auto e1 = signatures.generateDataSignatures(device_data_graph);
-	e1.wait();
-	
-	auto e2 = signatures.generateQuerySignatures(device_query_graph);
-	e2.wait();
-	
-	auto e3 = sigmo::isomorphism::filter::filterCandidates<sigmo::CandidatesDomain::Query>(queue, device_query_graph, device_data_graph, signatures, candidates);
-	e3.wait();
-	
-	// Start refining candidate set.
-	for (size_t ref_step = 1; ref_step <= args.refinement_steps; ++ref_step) {
-		auto e1 = signatures.refineDataSignatures(device_data_graph, ref_step);
-		e1.wait();
-	
-		auto e2 = signatures.refineQuerySignatures(device_query_graph, ref_step);
-		e2.wait();
-	
-		auto e3 = sigmo::isomorphism::filter::refineCandidates<sigmo::CandidatesDomain::Query>(queue, device_query_graph, device_data_graph, signatures, candidates);
-		e3.wait();
-	}
-	host_time_events.add("filter_end");
-	
-	std::chrono::duration<double> join_time{0};
-	size_t* num_matches = sycl::malloc_shared<size_t>(1, queue);
-	num_matches[0] = 0;
-	if (!args.skip_join) {
-		host_time_events.add("mapping_start");
-		sigmo::isomorphism::mapping::GMCR gmcr{queue};
-		gmcr.generateGMCR(device_query_graph, device_data_graph, candidates);
-		host_time_events.add("mapping_end");
-		host_time_events.add("join_start");
-		auto join_e = sigmo::isomorphism::join::joinCandidates(queue, device_query_graph, device_data_graph, candidates, gmcr, num_matches, !args.find_all);
-		join_e.wait();
-		host_time_events.add("join_end");
-	}
+	// Data signatures of every refinement level, then the filter and the join of the query batch, per data batch.
+	host_time_events.add("setup_data_start");
+	RankResult result = dynamic ? runDynamic(args, index, engine, query_graphs, thread_level >= MPI_THREAD_SERIALIZED)
+	                            : runStatic(args, index, engine, query_graphs);
+	host_time_events.add("join_end");
 	double rank_time = std::chrono::duration_cast<std::chrono::milliseconds>(host_time_events.getRangeTime("setup_data_start", "join_end")).count();
 	std::vector<double> rank_times;
+	std::vector<unsigned long> rank_graphs, rank_chunks;
 	if (mpi_rank == 0) {
 		rank_times.resize(mpi_size);
+		rank_graphs.resize(mpi_size);
+		rank_chunks.resize(mpi_size);
 	}
 	MPI_Gather(&rank_time, 1, MPI_DOUBLE, rank_times.data(), 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	unsigned long local_graphs = result.data_graphs, local_chunks = result.chunks;
+	MPI_Gather(&local_graphs, 1, MPI_UNSIGNED_LONG, rank_graphs.data(), 1, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+	MPI_Gather(&local_chunks, 1, MPI_UNSIGNED_LONG, rank_chunks.data(), 1, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
 
 	MPI_Barrier(MPI_COMM_WORLD);
 	if (mpi_rank == 0) {
@@ -209,25 +306,28 @@ std::vector<std::string> loadFileLinesMPI(const std::string &filename, int max_l
 	}
 
 	size_t total_matches = 0;
-	MPI_Reduce(num_matches, &total_matches, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	MPI_Reduce(&result.matches, &total_matches, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	size_t total_data_graphs = 0;
+	MPI_Reduce(&result.data_graphs, &total_data_graphs, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	size_t total_oversized_data_graphs = 0;
+	MPI_Reduce(&result.oversized_data_graphs, &total_oversized_data_graphs, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
 	if (mpi_rank == 0) {    
 		std::cout << "------------- Results -------------" << std::endl;
 		std::cout << "MPI time: "
 			<< std::chrono::duration_cast<std::chrono::milliseconds>(host_time_events.getRangeTime("mpi_start", "mpi_end")).count() << " ms"
 			<< std::endl;
+		std::cout << "# Data Graphs " << formatNumber(total_data_graphs) << std::endl;
+		std::cout << "# Host routed data graphs: " << formatNumber(total_oversized_data_graphs) << std::endl;
 		std::cout << "# Total matches: " << formatNumber(total_matches) << std::endl;
 		std::cout << "# Average matches: " << formatNumber(total_matches / mpi_size) << std::endl;
 		for (int i = 0; i < mpi_size; ++i) {
-			std::cout << "Rank " << i << ": " << rank_times[i] << " ms" << std::endl;
+			std::cout << "Rank " << i << ": " << rank_times[i] << " ms, " << formatNumber(rank_graphs[i]) << " data graphs in " << rank_chunks[i]
+				<< " chunks" << std::endl;
 		}
 	}
 
-	sycl::free(num_matches, queue);
-	sigmo::destroyDeviceCSRGraph(device_data_graph, queue);
-	sigmo::destroyDeviceCSRGraph(device_query_graph, queue);
-	
 	// Finalize MPI.
 	MPI_Finalize();
 	
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2025 University of Salerno
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Long-running SIGMo: the data graphs, their signatures at every refinement level and the device buffers stay resident,
+// so a query batch only pays for the query signatures, the filter and the join.
+// Usage: sigmo_server -D <data_file> --socket <path>|- [-i <iterations>] [--find-all] ...
+//
+// Protocol (line based, over the Unix socket or stdin/stdout):
+// - a batch is a sequence of query graphs in the query file format, terminated by an empty line;
+// - every batch is answered with "matches <n> pairs <n> queries <n> filter_ms <t> join_ms <t> host_ms <t>" or "error <message>";
+// - QUIT closes the connection, SHUTDOWN stops the server.
+// A client that goes away mid-answer only closes its connection: SIGPIPE is ignored and the write fails with EPIPE.
+
+#include "./utils.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sigmo.hpp>
+#include <sstream>
+#include <sycl/sycl.hpp>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * Buffered line reader and writer over a pair of file descriptors (a socket, or stdin and stdout).
+ */
+class LineChannel {
+public:
+  LineChannel(int in_fd, int out_fd) : in_fd(in_fd), out_fd(out_fd) {}
+
+  bool readLine(std::string& line) {
+    while (true) {
+      auto pos = buffer.find('\n');
+      if (pos != std::string::npos) {
+        line = buffer.substr(0, pos);
+        buffer.erase(0, pos + 1);
+        if (!line.empty() && line.back() == '\r') { line.pop_back(); }
+        return true;
+      }
+      char chunk[4096];
+      ssize_t n = ::read(in_fd, chunk, sizeof(chunk));
+      if (n <= 0) {
+        if (buffer.empty()) { return false; }
+        line.swap(buffer);
+        buffer.clear();
+        return true;
+      }
+      buffer.append(chunk, n);
+    }
+  }
+
+  /**
+   * Write a line, return false when the peer is gone (EPIPE) or the write fails.
+   */
+  bool writeLine(const std::string& line) {
+    std::string data = line + "\n";
+    for (size_t offset = 0; offset < data.size();) {
+      ssize_t n = ::write(out_fd, data.data() + offset, data.size() - offset);
+      if (n < 0 && errno == EINTR) { continue; }
+      if (n <= 0) { return false; }
+      offset += n;
+    }
+    return true;
+  }
+
+private:
+  int in_fd;
+  int out_fd;
+  std::string buffer;
+};
+
+std::string runBatch(sigmo::HybridEngine& engine, const std::vector<std::string>& lines) {
+  auto query_graphs = sigmo::io::loadCSRGraphsFromLines(lines);
+  auto result = engine.runQueries(query_graphs);
+  std::ostringstream response;
+  response << "matches " << result.matches << " pairs " << result.pairs << " queries " << result.query_graphs << " filter_ms "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(result.query_signature_time + result.filter_time).count() << " join_ms "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(result.join_time).count() << " host_ms "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(result.host_time).count();
+  return response.str();
+}
+
+/**
+ * Answer a batch, return false when the answer cannot be written back.
+ */
+bool answer(LineChannel& channel, sigmo::HybridEngine& engine, std::vector<std::string>& batch) {
+  if (batch.empty()) { return true; }
+  std::string response;
+  try {
+    response = runBatch(engine, batch);
+  } catch (std::exception& e) { response = std::string("error ") + e.what(); }
+  batch.clear();
+  return channel.writeLine(response);
+}
+
+/**
+ * Answer the batches of a connection, return false when the client asks to stop the server.
+ */
+bool serve(LineChannel& channel, sigmo::HybridEngine& engine) {
+  std::vector<std::string> batch;
+  std::string line;
+  while (channel.readLine(line)) {
+    if (line == "QUIT") { return true; }
+    if (line == "SHUTDOWN") { return false; }
+    if (!line.empty()) {
+      batch.push_back(line);
+      continue;
+    }
+    if (!answer(channel, engine, batch)) { return true; } // the client is gone, wait for the next one
+  }
+  answer(channel, engine, batch); // a batch left open by the end of the stream
+  return true;
+}
+
+int openSocket(const std::string& path) {
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) { throw std::runtime_error("Cannot create the socket"); }
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) { throw std::runtime_error("Socket path too long: " + path); }
+  std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  ::unlink(path.c_str());
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(fd, 8) < 0) {
+    throw std::runtime_error("Cannot listen on " + path);
+  }
+  return fd;
+}
+
+int main(int argc, char** argv) {
+  Args args{argc, argv, sigmo::device::deviceOptions};
+  if (args.data_file.empty() || args.socket_path.empty()) { throw std::runtime_error("Specify the data file and --socket <path>|-"); }
+  const std::string& socket_path = args.socket_path;
+  std::signal(SIGPIPE, SIG_IGN); // a client closing early makes the write fail instead of killing the server
+
+  sycl::queue queue{sycl::gpu_selector_v, sycl::property::queue::enable_profiling{}};
+  TimeEvents host_time_events;
+  host_time_events.add("setup_data_start");
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(args.data_file);
+  const size_t num_data_graphs = data_graphs.size();
+  for (size_t i = 1; i < args.multiply_factor_data; ++i) {
+    data_graphs.insert(data_graphs.end(), data_graphs.begin(), data_graphs.begin() + num_data_graphs);
+  }
+  if (data_graphs.size() > args.max_data_graphs) { data_graphs.erase(data_graphs.begin() + args.max_data_graphs, data_graphs.end()); }
+  sigmo::HybridEngine engine{queue, args.getEngineConfig(sigmo::device::deviceOptions), args.num_threads};
+  engine.loadData(data_graphs);
+  host_time_events.add("setup_data_end");
+  std::cerr << "[*] Resident " << formatNumber(engine.getNumDataGraphs()) << " data graphs (" << formatNumber(engine.getNumDataNodes()) << " nodes, "
+            << args.refinement_steps + 1 << " signature levels) in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(host_time_events.getRangeTime("setup_data_start", "setup_data_end")).count()
+            << " ms on " << queue.get_device().get_info<sycl::info::device::name>() << std::endl;
+
+  if (socket_path == "-") {
+    LineChannel channel{STDIN_FILENO, STDOUT_FILENO};
+    serve(channel, engine);
+    return 0;
+  }
+
+  int server_fd = openSocket(socket_path);
+  std::cerr << "[*] Listening on " << socket_path << std::endl;
+  for (bool running = true; running;) {
+    int client_fd = ::accept(server_fd, nullptr, nullptr);
+    if (client_fd < 0) { continue; }
+    LineChannel channel{client_fd, client_fd};
+    running = serve(channel, engine);
+    ::close(client_fd);
+  }
+  ::close(server_fd);
+  ::unlink(socket_path.c_str());
+  return 0;
+}
@@ -31,12 +31,24 @@ public:
   size_t multiply_factor_query = 1;
   size_t multiply_factor_data = 1;
   bool find_all = false;
-  std::string candidates_domain = "query";
+  std::string candidates_domain = "auto";
   size_t join_work_group_size = 0;
   size_t max_data_graphs = 1000000;
   size_t max_query_graphs = 1000;
   Args::Filter query_filter;
   bool skip_print_candidates = false;
+  bool aligned_candidates = false;
+  bool compact_candidates = false;
+  bool cache_candidates = false;
+  std::string join_kernel = "auto";
+  std::string join_engine = "dfs";
+  bool join_file_order = false;
+  std::string socket_path;
+  std::string backend = "sycl";
+  size_t num_threads = 0;
+  std::string devices; // empty for the single GPU pipeline
+  std::string mpi_schedule = "dynamic";
+  size_t mpi_chunk_kb = 1024;
 
   Args(int& argc, char**& argv, sigmo::device::DeviceOptions& device_options) {
     cxxopts::Options options(argv[0], "Command line options");
@@ -44,7 +56,7 @@ public:
         "i,iterations", "Number of refinement iterations", cxxopts::value<int>(refinement_steps))(
         "Q", "Define the query file to read", cxxopts::value<std::string>(query_file))(
         "D", "Define the data file to read", cxxopts::value<std::string>(data_file))(
-        "c,candidates-domain", "Select the candidates domain [query, data]", cxxopts::value<std::string>(candidates_domain))(
+        "c,candidates-domain", "Select the candidates domain [auto, query, data]", cxxopts::value<std::string>(candidates_domain))(
         "m,multiply", "Multiply the number of all graphs by a factor", cxxopts::value<size_t>())(
         "d,mul-data", "Multiply the number of data graphs by a factor", cxxopts::value<size_t>(multiply_factor_data))(
         "q,mul-query", "Multiply the number of query graphs by a factor", cxxopts::value<size_t>(multiply_factor_query))(
@@ -52,12 +64,42 @@ public:
         "find-all", "Find all matches without stopping at the first one", cxxopts::value<bool>(find_all))(
         "query-filter", "Apply a filter to the query graphs. Format: min[:max]", cxxopts::value<std::string>())(
         "skip-candidates-analysis", "Skip the analysis of the candidates", cxxopts::value<bool>(skip_print_candidates))(
+        "aligned-candidates", "Align each data graph slice of the candidates to a 64-bit word", cxxopts::value<bool>(aligned_candidates))(
+        "compact-candidates",
+        "Compact the candidates into the surviving (query, data) graph pairs before the join",
+        cxxopts::value<bool>(compact_candidates))(
+        "join-kernel", "Select the join kernel [auto, graph, pair, wildcard, cooperative]", cxxopts::value<std::string>(join_kernel))(
+        "join-file-order",
+        "Join the data graphs in file order instead of heavy-first",
+        cxxopts::value<bool>(join_file_order))(
+        "join-engine",
+        "Select the join engine [dfs, bfs, trie]. The BFS and trie engines apply to --find-all runs",
+        cxxopts::value<std::string>(join_engine))(
+        "bfs-frontier-mb",
+        "Set the memory budget of the BFS join frontier in MiB. Default 512.",
+        cxxopts::value<size_t>())(
+        "cache-candidates", "Materialize the candidate lists of the DQCR pairs before the join", cxxopts::value<bool>(cache_candidates))(
+        "backend", "Select the backend [sycl, host]. The host backend runs on native threads", cxxopts::value<std::string>(backend))(
+        "threads", "Set the threads of the host backend. Default all the hardware threads.", cxxopts::value<size_t>(num_threads))(
+        "devices",
+        "Split the data graphs over several devices weighted by their throughput [gpu, all, comma separated device indices]",
+        cxxopts::value<std::string>(devices))(
+        "mpi-schedule",
+        "Distribute the data file over the ranks [dynamic, static]. Dynamic ranks claim chunks from a shared counter (sigmo_mpi)",
+        cxxopts::value<std::string>(mpi_schedule))(
+        "mpi-chunk-kb", "Set the size of a dynamic data chunk in KiB. Default 1024.", cxxopts::value<size_t>(mpi_chunk_kb))(
+        "socket",
+        "Serve query batches on a Unix socket, '-' reads them from stdin. Required by sigmo_server, which takes no query file",
+        cxxopts::value<std::string>(socket_path))(
         "max-data-graphs", "Limit the number of data graphs", cxxopts::value<size_t>(max_data_graphs))(
         "max-query-graphs", "Limit the number of query graphs", cxxopts::value<size_t>(max_query_graphs))(
         "join-work-group", "Set the work group size for the join kernel. Default 128.", cxxopts::value<size_t>(device_options.join_work_group_size))(
         "filter-work-group",
         "Set the work group size for the filter kernel. Default 512.",
-        cxxopts::value<size_t>(device_options.filter_work_group_size));
+        cxxopts::value<size_t>(device_options.filter_work_group_size))(
+        "refine-tile",
+        "Set the query nodes staged per work group by the refine kernel, 0 disables tiling. Default 32.",
+        cxxopts::value<size_t>(device_options.refine_query_tile));
     auto result = options.parse(argc, argv);
 
     if (result.count("help")) {
@@ -67,10 +109,20 @@ public:
 
     if (result.count("Q") && result.count("D")) {
       query_data = true;
+    } else if (result.count("socket") && result.count("D")) {
+      query_data = false; // the queries come from the socket
     } else if (result.count("Q") || result.count("D")) {
-      throw std::runtime_error("Both query and data files must be provided");
+      throw std::runtime_error("Both query and data files must be provided, or the data file and --socket for sigmo_server");
     }
 
+    if (join_file_order) { device_options.join_heavy_first = false; }
+    if (result.count("bfs-frontier-mb")) { device_options.bfs_frontier_max_bytes = result["bfs-frontier-mb"].as<size_t>() << 20; }
+    if (join_engine != "dfs" && join_engine != "bfs" && join_engine != "trie") { throw std::runtime_error("Invalid join engine: " + join_engine); }
+    if (backend != "sycl" && backend != "host") { throw std::runtime_error("Invalid backend: " + backend); }
+    if (!devices.empty() && backend == "host") { throw std::runtime_error("The host backend does not run on devices"); }
+    if (mpi_schedule != "dynamic" && mpi_schedule != "static") { throw std::runtime_error("Invalid MPI schedule: " + mpi_schedule); }
+    if (mpi_chunk_kb == 0) { throw std::runtime_error("The MPI chunk size must be positive"); }
+
     if (result.count("multiply")) { multiply_factor_data = multiply_factor_query = result["multiply"].as<size_t>(); }
 
     if (result.count("query-filter")) {
@@ -88,6 +140,41 @@ public:
 
   bool isCandidateDomainQuery() const { return candidates_domain == "query"; }
   bool isCandidateDomainData() const { return candidates_domain == "data"; }
+  sigmo::CandidatesDomain getCandidatesDomain(size_t query_nodes, size_t data_nodes) const {
+    if (isCandidateDomainQuery()) { return sigmo::CandidatesDomain::Query; }
+    if (isCandidateDomainData()) { return sigmo::CandidatesDomain::Data; }
+    if (candidates_domain != "auto") { throw std::runtime_error("Invalid candidates domain: " + candidates_domain); }
+    return sigmo::candidates::selectCandidatesDomain(query_nodes, data_nodes);
+  }
+  sigmo::isomorphism::join::JoinPolicy getJoinPolicy() const {
+    if (join_kernel == "auto") { return sigmo::isomorphism::join::JoinPolicy::Auto; }
+    if (join_kernel == "graph") { return sigmo::isomorphism::join::JoinPolicy::Graph; }
+    if (join_kernel == "pair") { return sigmo::isomorphism::join::JoinPolicy::Pair; }
+    if (join_kernel == "wildcard") { return sigmo::isomorphism::join::JoinPolicy::Wildcard; }
+    if (join_kernel == "cooperative") { return sigmo::isomorphism::join::JoinPolicy::Cooperative; }
+    throw std::runtime_error("Invalid join kernel: " + join_kernel);
+  }
+  bool isJoinEngineBFS() const { return join_engine == "bfs"; }
+  bool isJoinEngineTrie() const { return join_engine == "trie"; }
+  bool isBackendHost() const { return backend == "host"; }
+  bool isMultiDevice() const { return !devices.empty(); }
+  bool isMPIScheduleDynamic() const { return mpi_schedule == "dynamic"; }
+  sigmo::CandidatesLayout getCandidatesLayout() const {
+    return aligned_candidates ? sigmo::CandidatesLayout::Aligned : sigmo::CandidatesLayout::Packed;
+  }
+  sigmo::EngineConfig getEngineConfig(const sigmo::device::DeviceOptions& device_options) const {
+    sigmo::EngineConfig config;
+    config.refinement_steps = refinement_steps;
+    config.find_all = find_all;
+    config.skip_join = skip_join;
+    if (isCandidateDomainQuery()) { config.domain = sigmo::CandidatesDomain::Query; }
+    if (isCandidateDomainData()) { config.domain = sigmo::CandidatesDomain::Data; }
+    if (!config.domain && candidates_domain != "auto") { throw std::runtime_error("Invalid candidates domain: " + candidates_domain); }
+    config.layout = getCandidatesLayout();
+    config.join_policy = getJoinPolicy();
+    config.device_options = device_options;
+    return config;
+  }
 };
 
 struct TimeEvents {
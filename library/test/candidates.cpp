@@ -7,6 +7,7 @@
 #include "./include/utils.hpp"
 #include "gtest/gtest.h"
 #include <bitset>
+#include <random>
 #include <sigmo.hpp>
 #include <sycl/sycl.hpp>
 
@@ -31,6 +32,31 @@ TEST(SignatureTest, CheckSignatureMethods) {
   ASSERT_EQ(signature.signature, 0b0010111100000000000000000000000000000000001000000000001100000001);
 }
 
+TEST(SignatureTest, CheckSignatureDominance) {
+  using SignatureDevice = sigmo::signature::Signature<>::SignatureDevice;
+  std::mt19937_64 rng(42);
+
+  for (int i = 0; i < 10000; ++i) {
+    SignatureDevice data{rng()}, query{rng() & rng()};
+    bool expected = true;
+    for (uint8_t l = 0; l < SignatureDevice::getMaxLabels(); l++) { expected &= query.getLabelCount(l) <= data.getLabelCount(l); }
+    ASSERT_EQ(data.dominates(query), expected);
+  }
+
+  SignatureDevice data{0}, query{0};
+  data.setLabelCount(3, 2);
+  query.setLabelCount(3, 2);
+  ASSERT_TRUE(data.dominates(query));
+  query.setLabelCount(15, 1);
+  ASSERT_FALSE(data.dominates(query));
+  ASSERT_TRUE(query.dominates(data));
+
+  uint64_t wide_data[2]{~0ull, 0x0f}, wide_query[2]{0x1234, 0x0e};
+  ASSERT_TRUE((sigmo::utils::swar::dominates<uint64_t, 4>(wide_data, wide_query)));
+  wide_query[1] = 0x1f;
+  ASSERT_FALSE((sigmo::utils::swar::dominates<uint64_t, 4>(wide_data, wide_query)));
+}
+
 TEST(SignatureTest, CheckQuerySignatureGeneration) {
   sycl::queue queue{sycl::gpu_selector_v};
 
@@ -142,6 +168,96 @@ TEST(CandidateTest, CheckInsertAndRemove) {
   ASSERT_EQ(device_candidates.candidates[3], 0b0u);
 }
 
+TEST(CandidateTest, CheckAlignedGraphSlice) {
+  // two data graphs of 5 and 70 nodes: the second slice starts on the next 64-bit word and spans two words
+  std::vector<sigmo::types::node_t> slice_offsets{0, 64, 192};
+  std::vector<sigmo::types::candidates_t> bitmap(2 * 192 / 32, 0);
+  sigmo::candidates::Candidates::CandidatesDevice device_candidates{2, 192};
+  device_candidates.setDataCandidates(bitmap.data());
+  device_candidates.layout = sigmo::CandidatesLayout::Aligned;
+  device_candidates.slice_offsets = slice_offsets.data();
+
+  // query node 1 has candidates 1, 3 in the first graph and 5, 68, 74 in the second one (global ids)
+  device_candidates.insert(1, 1);
+  device_candidates.insert(1, 3);
+  device_candidates.insert(1, 64 + 0);
+  device_candidates.insert(1, 64 + 63);
+  device_candidates.insert(1, 64 + 69);
+
+  auto first = device_candidates.getGraphSlice(1, 0, 0, 5);
+  ASSERT_EQ(first.getCandidatesCount(0), 2);
+  ASSERT_EQ(first.getCandidateAt(0, 1), 3);
+  ASSERT_EQ(device_candidates.getGraphSlice(0, 0, 0, 5).getCandidatesCount(0), 0);
+
+  auto second = device_candidates.getGraphSlice(1, 1, 5, 75);
+  ASSERT_EQ(second.getCandidatesCount(0), 3);
+  ASSERT_EQ(second.getCandidateAt(0, 0), 5);
+  ASSERT_EQ(second.getCandidateAt(0, 1), 68);
+  ASSERT_EQ(second.getCandidateAt(0, 2), 74);
+  ASSERT_EQ(second.getCandidateAt(0, 3), static_cast<sigmo::types::node_t>(-1));
+}
+
+TEST(CandidateTest, CheckDataDomainGraphSlice) {
+  // 75 data nodes (graphs [0, 5) and [5, 75)) over 40 query nodes: rows are data nodes, bits are query nodes
+  std::vector<sigmo::types::candidates_t> bitmap(75 * 2, 0);
+  sigmo::candidates::Candidates::CandidatesDevice device_candidates{75, 40};
+  device_candidates.setDataCandidates(bitmap.data());
+  device_candidates.domain = sigmo::CandidatesDomain::Data;
+
+  // query graph starting at node 33, its node 1 has candidates 2 in the first graph and 5, 68, 74 in the second one
+  for (sigmo::types::node_t data_node : {2, 5, 68, 74}) { device_candidates.insert(data_node, 34); }
+  device_candidates.insert(6, 33);
+
+  auto first = device_candidates.getGraphSlice(33, 0, 0, 5);
+  ASSERT_EQ(first.getCandidatesCount(0), 0);
+  ASSERT_EQ(first.getCandidatesCount(1), 1);
+  ASSERT_EQ(first.getCandidateAt(1, 0), 2);
+
+  auto second = device_candidates.getGraphSlice(33, 1, 5, 75);
+  ASSERT_EQ(second.getCandidatesCount(0), 1);
+  ASSERT_EQ(second.getCandidatesCount(1), 3);
+  ASSERT_EQ(second.getCandidateAt(1, 1), 68);
+  ASSERT_EQ(second.getCandidateAt(1, 3), static_cast<sigmo::types::node_t>(-1));
+  ASSERT_EQ(second.getCandidatesWord(1, 0), (1ULL << 0) | (1ULL << 63));
+  ASSERT_EQ(second.getCandidatesWord(1, 1), 1ULL << 5);
+}
+
+TEST(CandidateTest, CheckCandidatesSummary) {
+  // 40 query nodes over 2 data graphs: every query node but 35 has a candidate in graph 0, only 0..3 in graph 1
+  std::vector<uint32_t> summary{~0u, 0xFFu & ~(1u << 3), 0xFu, 0u};
+  sigmo::candidates::Candidates::CandidatesDevice device_candidates{40, 10};
+  device_candidates.summary = summary.data();
+  device_candidates.summary_words = 2;
+
+  ASSERT_TRUE(device_candidates.hasCandidates(0, 35, 0, 0, 5));
+  ASSERT_FALSE(device_candidates.hasCandidates(30, 6, 0, 0, 5));
+  ASSERT_TRUE(device_candidates.hasCandidates(36, 4, 0, 0, 5));
+  ASSERT_TRUE(device_candidates.hasCandidates(0, 4, 1, 5, 10));
+  ASSERT_FALSE(device_candidates.hasCandidates(2, 3, 1, 5, 10));
+}
+
+TEST(CandidateTest, CheckPairCandidateLists) {
+  // two pairs of a 2-node query graph: lists {1, 4} {0} for the first pair, {} {2, 3, 6} for the second one
+  std::vector<sigmo::candidates::PairCandidateLists::local_node_t> pool{1, 4, 0, 2, 3, 6};
+  std::vector<uint32_t> pair_lists{0, 2, 4};
+  std::vector<uint32_t> list_offsets{0, 2, 3, 3, 6};
+  sigmo::candidates::PairCandidateLists::PairCandidateListsDevice lists;
+  lists.candidates = pool.data();
+  lists.pair_lists = pair_lists.data();
+  lists.list_offsets = list_offsets.data();
+
+  auto first = lists.getPairSlice(0, 10, 15);
+  ASSERT_EQ(first.getCandidatesCount(0), 2);
+  ASSERT_EQ(first.getCandidateAt(0, 1), 14);
+  ASSERT_EQ(first.getCandidateAt(1, 0), 10);
+
+  auto second = sigmo::candidates::getSlice(lists, 1, 0, 0, 20, 27);
+  ASSERT_EQ(second.getCandidatesCount(0), 0);
+  ASSERT_EQ(second.getCandidatesCount(1), 3);
+  ASSERT_EQ(second.getCandidateAt(1, 2), 26);
+  ASSERT_EQ(second.getCandidateAt(1, 3), static_cast<sigmo::types::node_t>(-1));
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
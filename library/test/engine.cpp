@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2025 University of Salerno
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "./include/utils.hpp"
+#include "gtest/gtest.h"
+#include <sigmo.hpp>
+#include <sycl/sycl.hpp>
+#include <thread>
+
+namespace {
+
+sigmo::EngineConfig getTestConfig() {
+  sigmo::EngineConfig config;
+  config.refinement_steps = 2;
+  config.find_all = true;
+  return config;
+}
+
+} // namespace
+
+TEST(EngineTest, ReuseDataAcrossBatches) {
+  sycl::queue queue{sycl::gpu_selector_v, sycl::property::queue::enable_profiling{}};
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+
+  sigmo::Engine engine{queue, getTestConfig()};
+  ASSERT_THROW(engine.runQueries(query_graphs), std::runtime_error);
+  engine.loadData(data_graphs);
+  ASSERT_EQ(engine.getNumDataGraphs(), data_graphs.size());
+
+  auto first = engine.runQueries(query_graphs);
+  auto second = engine.runQueries(query_graphs);
+  ASSERT_EQ(first.query_graphs, query_graphs.size());
+  ASSERT_GT(first.matches, 0);
+  ASSERT_EQ(first.matches, second.matches);
+  ASSERT_EQ(first.pairs, second.pairs);
+
+  // a batch of a single query reuses the query buffers sized for the larger one
+  std::vector<sigmo::CSRGraph> single_query{query_graphs.front()};
+  auto single = engine.runQueries(single_query);
+  ASSERT_LE(single.matches, first.matches);
+  ASSERT_LE(single.pairs, data_graphs.size());
+}
+
+TEST(EngineTest, ConcurrentEngines) {
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+
+  sycl::queue reference_queue{sycl::gpu_selector_v, sycl::property::queue::enable_profiling{}};
+  sigmo::Engine reference{reference_queue, getTestConfig()};
+  reference.loadData(data_graphs);
+  auto expected = reference.runQueries(query_graphs);
+
+  // engines with different device options on their own queues and threads agree with the reference
+  constexpr size_t num_engines = 2;
+  std::vector<sigmo::QueryResult> results(num_engines);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_engines; ++i) {
+    threads.emplace_back([&, i]() {
+      sycl::queue queue{sycl::gpu_selector_v, sycl::property::queue::enable_profiling{}};
+      auto config = getTestConfig();
+      config.device_options.join_work_group_size = 64 << i;
+      config.device_options.join_heavy_first = i % 2 == 0;
+      auto local_data_graphs = data_graphs;
+      auto local_query_graphs = query_graphs;
+      sigmo::Engine engine{queue, config};
+      engine.loadData(local_data_graphs);
+      results[i] = engine.runQueries(local_query_graphs);
+    });
+  }
+  for (auto& thread : threads) { thread.join(); }
+
+  for (auto& result : results) {
+    ASSERT_EQ(result.matches, expected.matches);
+    ASSERT_EQ(result.pairs, expected.pairs);
+  }
+}
+
+TEST(EngineTest, MultiDeviceMatchesSingleDevice) {
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+
+  sycl::queue reference_queue{sycl::gpu_selector_v, sycl::property::queue::enable_profiling{}};
+  sigmo::Engine reference{reference_queue, getTestConfig()};
+  reference.loadData(data_graphs);
+  auto expected = reference.runQueries(query_graphs);
+
+  // the default GPU twice, the slices cover the data graphs whatever the measured weights
+  sycl::device device{sycl::gpu_selector_v};
+  sigmo::MultiDeviceEngine engine{{device, device}, getTestConfig()};
+  engine.calibrate(query_graphs, data_graphs, 4);
+  engine.loadData(data_graphs);
+  auto result = engine.runQueries(query_graphs);
+
+  size_t sliced_graphs = 0;
+  for (size_t i = 0; i < engine.getNumDevices(); ++i) {
+    ASSERT_GT(engine.getWeight(i), 0);
+    sliced_graphs += engine.getNumDataGraphs(i);
+  }
+  ASSERT_EQ(sliced_graphs, data_graphs.size());
+  ASSERT_EQ(result.query_graphs, query_graphs.size());
+  ASSERT_EQ(result.matches, expected.matches);
+  ASSERT_EQ(result.pairs, expected.pairs);
+}
+
+TEST(EngineTest, JoinPoliciesAgree) {
+  using sigmo::isomorphism::join::JoinPolicy;
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+  sycl::queue queue{sycl::gpu_selector_v, sycl::property::queue::enable_profiling{}};
+
+  auto run = [&](JoinPolicy policy, bool find_all, size_t wide_candidates) {
+    auto config = getTestConfig();
+    config.find_all = find_all;
+    config.join_policy = policy;
+    config.device_options.join_wide_candidates = wide_candidates;
+    sigmo::Engine engine{queue, config};
+    engine.loadData(data_graphs);
+    return engine.runQueries(query_graphs).matches;
+  };
+
+  // every kernel counts the same embeddings, so the counts do not depend on the kernel mix
+  for (bool find_all : {true, false}) {
+    const size_t expected = run(JoinPolicy::Pair, find_all, 32);
+    ASSERT_GT(expected, 0);
+    for (auto policy : {JoinPolicy::Auto, JoinPolicy::Graph, JoinPolicy::Wildcard, JoinPolicy::Cooperative}) {
+      ASSERT_EQ(run(policy, find_all, 32), expected) << "policy " << static_cast<int>(policy) << ", find all " << find_all;
+    }
+    // Auto with every data graph wide enough for the wildcard kernel
+    ASSERT_EQ(run(JoinPolicy::Auto, find_all, 1), expected) << "find all " << find_all;
+  }
+}
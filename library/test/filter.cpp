@@ -12,18 +12,18 @@
 #include <sycl/sycl.hpp>
 
 TEST(FilterTest, SingleFilter) {
-  auto query_graphs = sigmo::io::loadAMGraphsFromFile(TEST_QUERY_PATH);
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
   auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
 
   sycl::queue queue{sycl::gpu_selector_v};
 
-  auto device_query_graph = sigmo::createDeviceAMGraph(queue, query_graphs);
+  auto device_query_graph = sigmo::createDeviceCSRGraph(queue, query_graphs);
   auto device_data_graph = sigmo::createDeviceCSRGraph(queue, data_graphs);
 
   sigmo::signature::Signature<> signatures{queue, device_data_graph.total_nodes, device_query_graph.total_nodes};
 
-  auto e1 = signatures.generateAMSignatures(device_query_graph);
-  auto e2 = signatures.generateCSRSignatures(device_data_graph);
+  auto e1 = signatures.generateQuerySignatures(device_query_graph);
+  auto e2 = signatures.generateDataSignatures(device_data_graph);
 
   queue.wait();
 
@@ -64,23 +64,23 @@ TEST(FilterTest, SingleFilter) {
   }
 
   sigmo::destroyDeviceCSRGraph(device_data_graph, queue);
-  sigmo::destroyDeviceAMGraph(device_query_graph, queue);
+  sigmo::destroyDeviceCSRGraph(device_query_graph, queue);
 }
 
 
 TEST(FilterTest, RefinementTest) {
-  auto query_graphs = sigmo::io::loadAMGraphsFromFile(TEST_QUERY_PATH);
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
   auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
 
   sycl::queue queue{sycl::gpu_selector_v};
 
-  auto device_query_graph = sigmo::createDeviceAMGraph(queue, query_graphs);
+  auto device_query_graph = sigmo::createDeviceCSRGraph(queue, query_graphs);
   auto device_data_graph = sigmo::createDeviceCSRGraph(queue, data_graphs);
 
   sigmo::signature::Signature<> signatures{queue, device_data_graph.total_nodes, device_query_graph.total_nodes};
 
-  auto e1 = signatures.generateAMSignatures(device_query_graph);
-  auto e2 = signatures.generateCSRSignatures(device_data_graph);
+  auto e1 = signatures.generateQuerySignatures(device_query_graph);
+  auto e2 = signatures.generateDataSignatures(device_data_graph);
 
 
   sigmo::candidates::Candidates candidates{queue, device_query_graph.total_nodes, device_data_graph.total_nodes};
@@ -111,8 +111,8 @@ TEST(FilterTest, RefinementTest) {
   }
 
 
-  signatures.refineCSRSignatures(device_data_graph).wait();
-  signatures.refineAMSignatures(device_query_graph).wait();
+  signatures.refineDataSignatures(device_data_graph).wait();
+  signatures.refineQuerySignatures(device_query_graph).wait();
 
   sigmo::isomorphism::filter::refineCandidates(queue, device_query_graph, device_data_graph, signatures, candidates).wait();
 
@@ -144,10 +144,57 @@ TEST(FilterTest, RefinementTest) {
   }
 
   sigmo::destroyDeviceCSRGraph(device_data_graph, queue);
-  sigmo::destroyDeviceAMGraph(device_query_graph, queue);
+  sigmo::destroyDeviceCSRGraph(device_query_graph, queue);
 }
 
 
+TEST(FilterTest, UnalignedWorkGroup) {
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
+
+  sycl::queue queue{sycl::gpu_selector_v};
+
+  auto device_query_graph = sigmo::createDeviceCSRGraph(queue, query_graphs);
+  auto device_data_graph = sigmo::createDeviceCSRGraph(queue, data_graphs);
+
+  sigmo::signature::Signature<> signatures{queue, device_data_graph.total_nodes, device_query_graph.total_nodes};
+  signatures.generateQuerySignatures(device_query_graph).wait();
+  signatures.generateDataSignatures(device_data_graph).wait();
+
+  auto filter = [&](size_t work_group_size) {
+    sigmo::device::DeviceOptions options = sigmo::device::deviceOptions;
+    options.filter_work_group_size = work_group_size;
+    sigmo::device::ScopedDeviceOptions scoped{options};
+    sigmo::candidates::Candidates candidates{queue, device_query_graph.total_nodes, device_data_graph};
+    sigmo::isomorphism::filter::filterCandidates(queue, device_query_graph, device_data_graph, signatures, candidates).wait();
+    auto device_candidates = candidates.getCandidatesDevice();
+    std::vector<sigmo::types::candidates_t> words(device_candidates.source_nodes * device_candidates.single_node_size);
+    queue.copy(device_candidates.candidates, words.data(), words.size()).wait();
+    return std::make_pair(words, device_candidates.single_node_size);
+  };
+
+  // the scalar label test, one bit per (query node, data node)
+  std::vector<sigmo::types::label_t> query_labels, data_labels;
+  for (auto& graph : query_graphs) { query_labels.insert(query_labels.end(), graph.getNodeLabels(), graph.getNodeLabels() + graph.getNumNodes()); }
+  for (auto& graph : data_graphs) { data_labels.insert(data_labels.end(), graph.getNodeLabels(), graph.getNodeLabels() + graph.getNumNodes()); }
+  constexpr size_t num_bits = sigmo::candidates::Candidates::CandidatesDevice::num_bits;
+
+  // 48 and 80 lanes start work-groups and sub-groups in the middle of a candidate word
+  for (size_t work_group_size : {48, 80, 512}) {
+    auto [words, row_size] = filter(work_group_size);
+    for (size_t query_node = 0; query_node < query_labels.size(); ++query_node) {
+      for (size_t data_node = 0; data_node < data_labels.size(); ++data_node) {
+        const bool expected = query_labels[query_node] == data_labels[data_node] || query_labels[query_node] == sigmo::types::WILDCARD_NODE;
+        const bool found = (words[query_node * row_size + data_node / num_bits] >> (data_node % num_bits)) & 1;
+        ASSERT_EQ(found, expected) << "work-group " << work_group_size << ", query node " << query_node << ", data node " << data_node;
+      }
+    }
+  }
+
+  sigmo::destroyDeviceCSRGraph(device_data_graph, queue);
+  sigmo::destroyDeviceCSRGraph(device_query_graph, queue);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
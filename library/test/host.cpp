@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2025 University of Salerno
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "./include/utils.hpp"
+#include "gtest/gtest.h"
+#include <sigmo.hpp>
+#include <sycl/sycl.hpp>
+
+TEST(HostTest, MatchSyclEngine) {
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+  sycl::queue queue{sycl::gpu_selector_v, sycl::property::queue::enable_profiling{}};
+
+  for (size_t refinement_steps = 0; refinement_steps <= 2; ++refinement_steps) {
+    for (bool find_all : {true, false}) {
+      sigmo::EngineConfig config;
+      config.refinement_steps = refinement_steps;
+      config.find_all = find_all;
+
+      sigmo::Engine engine{queue, config};
+      engine.loadData(data_graphs);
+      auto expected = engine.runQueries(query_graphs);
+
+      for (size_t num_threads : {1, 4}) {
+        sigmo::host::HostEngine host_engine{config, num_threads};
+        host_engine.loadData(data_graphs);
+        auto result = host_engine.runQueries(query_graphs);
+        ASSERT_EQ(result.query_graphs, query_graphs.size());
+        ASSERT_EQ(result.matches, expected.matches) << "refinement steps " << refinement_steps << ", find all " << find_all;
+        ASSERT_EQ(result.pairs, expected.pairs) << "refinement steps " << refinement_steps << ", find all " << find_all;
+      }
+    }
+  }
+}
+
+TEST(HostTest, RunBeforeLoad) {
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+  sigmo::host::HostEngine engine{sigmo::EngineConfig{}};
+  ASSERT_THROW(engine.runQueries(query_graphs), std::runtime_error);
+}
+
+TEST(HostTest, FallbackCompletesDevicePairs) {
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+  sigmo::EngineConfig config;
+  config.refinement_steps = 1;
+  config.find_all = true;
+  sigmo::host::HostEngine reference{config};
+  reference.loadData(data_graphs);
+  auto expected = reference.runQueries(query_graphs);
+
+  // with lowered limits, the device-sized pairs and the fallback pairs add up to the whole workload
+  for (size_t max_data_nodes : {8, 16, 1024}) {
+    for (size_t max_query_nodes : {3, 5, 1024}) {
+      auto sized_data = sigmo::io::splitBySize(std::vector<sigmo::CSRGraph>{data_graphs}, max_data_nodes);
+      auto sized_queries = sigmo::io::splitBySize(std::vector<sigmo::CSRGraph>{query_graphs}, max_query_nodes);
+      ASSERT_EQ(sized_data.device.size() + sized_data.oversized.size(), data_graphs.size());
+
+      sigmo::QueryResult device;
+      if (!sized_data.device.empty()) {
+        sigmo::host::HostEngine engine{config};
+        engine.loadData(sized_data.device);
+        device = engine.runQueries(sized_queries.device);
+      }
+      sigmo::host::FallbackEngine fallback{config};
+      fallback.loadData(sized_data.device, sized_data.oversized);
+      auto host = fallback.isNeeded(sized_queries) ? fallback.runQueries(sized_queries) : sigmo::QueryResult{};
+      ASSERT_EQ(device.matches + host.matches, expected.matches) << "limits " << max_data_nodes << ", " << max_query_nodes;
+      ASSERT_EQ(device.pairs + host.pairs, expected.pairs) << "limits " << max_data_nodes << ", " << max_query_nodes;
+    }
+  }
+}
+
+TEST(HostTest, HybridMatchesSyclEngine) {
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+  sycl::queue queue{sycl::gpu_selector_v, sycl::property::queue::enable_profiling{}};
+  sigmo::EngineConfig config;
+  config.refinement_steps = 1;
+  config.find_all = true;
+
+  sigmo::Engine engine{queue, config};
+  engine.loadData(data_graphs);
+  auto expected = engine.runQueries(query_graphs);
+
+  sigmo::HybridEngine hybrid{queue, config};
+  hybrid.loadData(data_graphs);
+  auto result = hybrid.runQueries(query_graphs);
+  ASSERT_EQ(hybrid.getNumDataGraphs(), data_graphs.size());
+  ASSERT_EQ(result.matches, expected.matches);
+  ASSERT_EQ(result.pairs, expected.pairs);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2025 University of Salerno
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "./include/utils.hpp"
+#include "gtest/gtest.h"
+#include <filesystem>
+#include <fstream>
+#include <sigmo.hpp>
+#include <sstream>
+
+TEST(IOTest, LineIndexSidecar) {
+  // a copy of the data file in the temporary path, so the sidecar never lands next to the test data
+  const std::string fname = std::string(TEST_TMP_PATH);
+  std::filesystem::copy_file(TEST_DATA_PATH, fname, std::filesystem::copy_options::overwrite_existing);
+  std::filesystem::remove(sigmo::io::LineIndex::getSidecarPath(fname));
+  auto index = sigmo::io::LineIndex::build(fname);
+  ASSERT_TRUE(index.write(fname));
+  auto read_index = sigmo::io::LineIndex::read(fname);
+  ASSERT_TRUE(read_index.has_value());
+  ASSERT_EQ(read_index->offsets, index.offsets);
+  ASSERT_EQ(sigmo::io::LineIndex::loadOrBuild(fname).offsets, index.offsets);
+
+  // every indexed line is the line getline reads
+  std::ifstream file(fname, std::ios::binary);
+  std::string content{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+  ASSERT_EQ(index.file_size, content.size());
+  std::istringstream lines(content);
+  size_t i = 0;
+  for (std::string line; std::getline(lines, line); ++i) {
+    ASSERT_LT(i, index.getNumLines());
+    auto indexed = content.substr(index.offsets[i], index.offsets[i + 1] - index.offsets[i]);
+    if (!indexed.empty() && indexed.back() == '\n') { indexed.pop_back(); }
+    ASSERT_EQ(indexed, line);
+  }
+  ASSERT_EQ(i, index.getNumLines());
+  std::filesystem::remove(sigmo::io::LineIndex::getSidecarPath(fname));
+  std::filesystem::remove(fname);
+}
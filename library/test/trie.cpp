@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2025 University of Salerno
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "./include/utils.hpp"
+#include "gtest/gtest.h"
+#include <sigmo.hpp>
+
+TEST(TrieTest, CheckQueryPaths) {
+  sycl::queue queue{sycl::gpu_selector_v};
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+  auto device_query_graph = sigmo::createDeviceCSRGraph(queue, query_graphs);
+  sigmo::isomorphism::trie::QueryTrie trie{queue, device_query_graph};
+  auto trie_device = trie.getQueryTrieDevice();
+
+  ASSERT_EQ(trie.getSkippedQueries(), 0);
+  ASSERT_LE(trie.getNumNodes(), trie.getNumIndexedQueryNodes());
+  ASSERT_EQ(trie_device.terminal_offsets[trie_device.num_nodes], query_graphs.size());
+
+  // walking the labels and the backward adjacency of every query ends at a node listing it
+  for (uint32_t query_graph_id = 0; query_graph_id < query_graphs.size(); ++query_graph_id) {
+    auto& graph = query_graphs[query_graph_id];
+    uint32_t current = 0;
+    for (uint32_t u = 0; u < graph.getNumNodes(); ++u) {
+      uint32_t backward = 0;
+      for (auto e = graph.getRowOffsets()[u]; e < graph.getRowOffsets()[u + 1]; ++e) {
+        if (graph.getColumnIndices()[e] < u) { backward |= 1u << graph.getColumnIndices()[e]; }
+      }
+      uint32_t next = 0;
+      for (uint32_t child = trie_device.child_offsets[current]; child < trie_device.child_offsets[current + 1]; ++child) {
+        if (trie_device.labels[child] == graph.getNodeLabels()[u] && trie_device.backward[child] == backward) { next = child; }
+      }
+      ASSERT_NE(next, 0);
+      ASSERT_TRUE(trie_device.hasPairedQuery(next, &query_graph_id, 1));
+      current = next;
+    }
+    bool terminal = false;
+    for (uint32_t i = trie_device.terminal_offsets[current]; i < trie_device.terminal_offsets[current + 1]; ++i) {
+      terminal |= trie_device.terminal_queries[i] == query_graph_id;
+    }
+    ASSERT_TRUE(terminal);
+  }
+
+  sigmo::destroyDeviceCSRGraph(device_query_graph, queue);
+}
+
+TEST(TrieTest, CheckSharedPrefixes) {
+  sycl::queue queue{sycl::gpu_selector_v};
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+  auto device_query_graph = sigmo::createDeviceCSRGraph(queue, query_graphs);
+  sigmo::isomorphism::trie::QueryTrie trie{queue, device_query_graph};
+
+  // duplicated queries are merged completely
+  auto duplicated_graphs = query_graphs;
+  duplicated_graphs.insert(duplicated_graphs.end(), query_graphs.begin(), query_graphs.end());
+  auto device_duplicated_graph = sigmo::createDeviceCSRGraph(queue, duplicated_graphs);
+  sigmo::isomorphism::trie::QueryTrie duplicated_trie{queue, device_duplicated_graph};
+
+  ASSERT_EQ(duplicated_trie.getNumNodes(), trie.getNumNodes());
+  ASSERT_EQ(duplicated_trie.getNumIndexedQueryNodes(), 2 * trie.getNumIndexedQueryNodes());
+
+  sigmo::destroyDeviceCSRGraph(device_duplicated_graph, queue);
+  sigmo::destroyDeviceCSRGraph(device_query_graph, queue);
+}
+
+TEST(TrieTest, CompactPairsFollowGMCR) {
+  sycl::queue queue{sycl::gpu_selector_v, sycl::property::queue::enable_profiling{}};
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
+  auto device_query_graph = sigmo::createDeviceCSRGraph(queue, query_graphs);
+  auto device_data_graph = sigmo::createDeviceCSRGraph(queue, data_graphs);
+
+  sigmo::signature::Signature<> signatures{queue, device_data_graph.total_nodes, device_query_graph.total_nodes};
+  sigmo::candidates::Candidates candidates{queue, device_query_graph.total_nodes, device_data_graph};
+  signatures.generateDataSignatures(device_data_graph).wait();
+  signatures.generateQuerySignatures(device_query_graph).wait();
+  sigmo::isomorphism::filter::filterCandidates<sigmo::CandidatesDomain::Query>(queue, device_query_graph, device_data_graph, signatures, candidates)
+      .wait();
+
+  sigmo::isomorphism::mapping::GMCR gmcr{queue};
+  gmcr.generateGMCR(device_query_graph, device_data_graph, candidates).wait();
+  sigmo::candidates::PairCandidates pair_candidates{queue};
+  pair_candidates.generatePairCandidates(device_query_graph, device_data_graph, candidates).wait();
+
+  // the compact pairs list the query graphs of every data graph in the GMCR order, the trie join relies on it
+  auto gmcr_device = gmcr.getGMCRDevice();
+  auto pairs = pair_candidates.getCandidatesDevice();
+  ASSERT_EQ(pair_candidates.getNumPairs(), gmcr_device.total_query_indices);
+  const size_t num_pairs = pair_candidates.getNumPairs();
+  std::vector<uint32_t> gmcr_offsets(data_graphs.size() + 1), pair_offsets(data_graphs.size() + 1);
+  std::vector<uint32_t> gmcr_queries(num_pairs), pair_queries(num_pairs);
+  queue.copy(gmcr_device.data_graph_offsets, gmcr_offsets.data(), gmcr_offsets.size());
+  queue.copy(pairs.data_graph_pairs, pair_offsets.data(), pair_offsets.size());
+  queue.copy(gmcr_device.query_graph_indices, gmcr_queries.data(), num_pairs);
+  queue.copy(pairs.pair_query_graphs, pair_queries.data(), num_pairs);
+  queue.wait();
+  ASSERT_EQ(pair_offsets, gmcr_offsets);
+  ASSERT_EQ(pair_queries, gmcr_queries);
+
+  sigmo::destroyDeviceCSRGraph(device_data_graph, queue);
+  sigmo::destroyDeviceCSRGraph(device_query_graph, queue);
+}
+
+TEST(TrieTest, JoinEnginesAgree) {
+  sycl::queue queue{sycl::gpu_selector_v, sycl::property::queue::enable_profiling{}};
+  auto query_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_QUERY_PATH);
+  auto data_graphs = sigmo::io::loadCSRGraphsFromFile(TEST_DATA_PATH);
+  auto device_query_graph = sigmo::createDeviceCSRGraph(queue, query_graphs);
+  auto device_data_graph = sigmo::createDeviceCSRGraph(queue, data_graphs);
+
+  sigmo::signature::Signature<> signatures{queue, device_data_graph.total_nodes, device_query_graph.total_nodes};
+  sigmo::candidates::Candidates candidates{queue, device_query_graph.total_nodes, device_data_graph};
+  signatures.generateDataSignatures(device_data_graph).wait();
+  signatures.generateQuerySignatures(device_query_graph).wait();
+  sigmo::isomorphism::filter::filterCandidates<sigmo::CandidatesDomain::Query>(queue, device_query_graph, device_data_graph, signatures, candidates)
+      .wait();
+  sigmo::isomorphism::mapping::GMCR gmcr{queue};
+  gmcr.generateGMCR(device_query_graph, device_data_graph, candidates).wait();
+  sigmo::isomorphism::trie::QueryTrie trie{queue, device_query_graph};
+  ASSERT_EQ(trie.getSkippedQueries(), 0);
+
+  size_t* num_matches = sigmo::device::memory::malloc<size_t>(1, queue);
+  auto count = [&](auto join) {
+    size_t matches;
+    queue.fill(num_matches, size_t{0}, 1).wait();
+    join().wait();
+    queue.copy(num_matches, &matches, 1).wait();
+    return matches;
+  };
+
+  // find-all counts of the depth-first kernels, the level-synchronous engine with and without its memory budget and the trie
+  sigmo::isomorphism::join::JoinDispatcher dispatcher{queue, sigmo::isomorphism::join::JoinPolicy::Pair};
+  const size_t expected = count([&]() { return dispatcher.run(device_query_graph, device_data_graph, candidates, gmcr, num_matches, false); });
+  ASSERT_GT(expected, 0);
+  sigmo::isomorphism::join::BFSJoinEngine bfs_engine{queue};
+  ASSERT_EQ(count([&]() { return bfs_engine.run(device_query_graph, device_data_graph, candidates, gmcr, num_matches); }), expected);
+  ASSERT_FALSE(bfs_engine.usedDepthFirst());
+  ASSERT_EQ(count([&]() { return bfs_engine.run(device_query_graph, device_data_graph, candidates, gmcr, num_matches, 0); }), expected);
+  ASSERT_TRUE(bfs_engine.usedDepthFirst());
+  ASSERT_EQ(count([&]() { return sigmo::isomorphism::join::joinTrie(queue, device_data_graph, trie, gmcr, num_matches); }), expected);
+
+  sycl::free(num_matches, queue);
+  sigmo::destroyDeviceCSRGraph(device_data_graph, queue);
+  sigmo::destroyDeviceCSRGraph(device_query_graph, queue);
+}